@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "owned_ptr.hpp"
+
+// Build with optimizations, for example:
+//   g++ -std=c++11 -O2 -pthread benchmark.cpp -o benchmark
+//
+// Run "benchmark stress" to check the owners under load instead, best built
+// with a sanitizer:
+//   g++ -std=c++11 -O1 -g -fsanitize=thread -pthread benchmark.cpp -o stress
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Operations timed together as one sample. Timing every lock() on its own
+// would mostly measure the clock.
+static const size_t batch = 256;
+
+static double elapsed_ns(bench_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(
+		bench_clock::now() - start).count();
+}
+
+// Prints the mean and 99th percentile of samples, each covering ops operations.
+static void report(const char *policy, const char *name, unsigned threads,
+	std::vector<double> &samples, size_t ops)
+{
+	double total = 0;
+	for (double sample : samples)
+	{
+		total += sample;
+	}
+	std::sort(samples.begin(), samples.end());
+	double p99 = samples[(samples.size() - 1) * 99 / 100];
+	std::printf("%-12s %-16s %3u thread(s) %12.1f ns/op %12.1f ns p99\n",
+		policy, name, threads, total / (samples.size() * ops), p99 / ops);
+}
+
+// Starts the given number of threads at once, and joins them.
+template <typename Body> static void run_threads(unsigned threads, Body body)
+{
+	std::atomic<unsigned> waiting(threads);
+	std::vector<std::thread> pool;
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		pool.emplace_back([&, i]()
+		{
+			waiting.fetch_sub(1);
+			while (waiting.load() != 0)
+			{
+				std::this_thread::yield();
+			}
+			body(i);
+		});
+	}
+	for (auto &thread : pool)
+	{
+		thread.join();
+	}
+}
+
+// Each thread locks and unlocks its own reader of one shared owner.
+template <typename Policy> static void bench_lock(const char *policy,
+	unsigned threads)
+{
+	owned_ptr<int, Policy> owner(new int(0));
+	std::vector<std::vector<double>> samples(threads);
+	run_threads(threads, [&](unsigned index)
+	{
+		reader_ptr<int, Policy> reader(&owner);
+		for (size_t i = 0; i < 2000; ++i)
+		{
+			auto start = bench_clock::now();
+			for (size_t j = 0; j < batch; ++j)
+			{
+				volatile int value = *reader.lock();
+				(void)value; // Remove 'unused' warnings.
+				reader.unlock();
+			}
+			samples[index].push_back(elapsed_ns(start));
+		}
+	});
+	std::vector<double> all;
+	for (auto &thread : samples)
+	{
+		all.insert(all.end(), thread.begin(), thread.end());
+	}
+	report(policy, "lock/unlock", threads, all, batch);
+}
+
+// Each thread creates and destroys readers of one shared owner.
+template <typename Policy> static void bench_churn(const char *policy,
+	unsigned threads)
+{
+	owned_ptr<int, Policy> owner(new int(0));
+	std::vector<std::vector<double>> samples(threads);
+	run_threads(threads, [&](unsigned index)
+	{
+		for (size_t i = 0; i < 500; ++i)
+		{
+			auto start = bench_clock::now();
+			for (size_t j = 0; j < batch; ++j)
+			{
+				reader_ptr<int, Policy> reader(&owner);
+			}
+			samples[index].push_back(elapsed_ns(start));
+		}
+	});
+	std::vector<double> all;
+	for (auto &thread : samples)
+	{
+		all.insert(all.end(), thread.begin(), thread.end());
+	}
+	report(policy, "get/destroy", threads, all, batch);
+}
+
+// Each thread takes its reader from a thread_reader, as a task would instead of
+// creating one.
+template <typename Policy> static void bench_local(const char *policy,
+	unsigned threads)
+{
+	owned_ptr<int, Policy> owner(new int(0));
+	thread_reader<int, Policy> local(&owner);
+	std::vector<std::vector<double>> samples(threads);
+	run_threads(threads, [&](unsigned index)
+	{
+		for (size_t i = 0; i < 500; ++i)
+		{
+			auto start = bench_clock::now();
+			for (size_t j = 0; j < batch; ++j)
+			{
+				reader_ptr<int, Policy> &reader = local.get();
+				volatile int value = *reader.lock();
+				(void)value; // Remove 'unused' warnings.
+				reader.unlock();
+			}
+			samples[index].push_back(elapsed_ns(start));
+		}
+	});
+	std::vector<double> all;
+	for (auto &thread : samples)
+	{
+		all.insert(all.end(), thread.begin(), thread.end());
+	}
+	report(policy, "local/lock", threads, all, batch);
+}
+
+// Keeps the readers locking and unlocking the owner until stop is set.
+template <typename Policy> static void hold(owned_ptr<int, Policy> &owner,
+	const std::atomic<bool> &stop)
+{
+	reader_ptr<int, Policy> reader(&owner);
+	while (!stop.load(std::memory_order_relaxed))
+	{
+		int *value = reader.lock();
+		if (value != nullptr)
+		{
+			for (volatile int i = 0; i < 100; ++i) {}
+		}
+		reader.unlock();
+		std::this_thread::yield();
+	}
+}
+
+// Times reset() while the given number of threads use the owner.
+template <typename Policy> static void bench_reset(const char *policy,
+	unsigned threads)
+{
+	owned_ptr<int, Policy> owner(new int(0));
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> pool;
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		pool.emplace_back([&]() { hold(owner, stop); });
+	}
+	std::vector<double> samples;
+	for (size_t i = 0; i < 1000; ++i)
+	{
+		auto start = bench_clock::now();
+		owner.reset(new int(static_cast<int>(i)));
+		samples.push_back(elapsed_ns(start));
+	}
+	stop.store(true);
+	for (auto &thread : pool)
+	{
+		thread.join();
+	}
+	report(policy, "reset", threads, samples, 1);
+}
+
+// Times deleting an owner while the given number of threads use it.
+template <typename Policy> static void bench_destroy(const char *policy,
+	unsigned threads)
+{
+	std::vector<double> samples;
+	for (size_t i = 0; i < 200; ++i)
+	{
+		auto owner = new owned_ptr<int, Policy>(new int(0));
+		std::atomic<bool> stop(false);
+		std::vector<std::thread> pool;
+		for (unsigned j = 0; j < threads; ++j)
+		{
+			pool.emplace_back([&]() { hold(*owner, stop); });
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		auto start = bench_clock::now();
+		delete owner;
+		samples.push_back(elapsed_ns(start));
+		stop.store(true);
+		for (auto &thread : pool)
+		{
+			thread.join();
+		}
+	}
+	report(policy, "destroy", threads, samples, 1);
+}
+
+// Each thread copies the value out of one shared owned_value.
+static void bench_value(unsigned threads)
+{
+	owned_value<int> cell(0);
+	std::vector<std::vector<double>> samples(threads);
+	run_threads(threads, [&](unsigned index)
+	{
+		for (size_t i = 0; i < 2000; ++i)
+		{
+			auto start = bench_clock::now();
+			for (size_t j = 0; j < batch; ++j)
+			{
+				volatile int value = cell.load();
+				(void)value; // Remove 'unused' warnings.
+			}
+			samples[index].push_back(elapsed_ns(start));
+		}
+	});
+	std::vector<double> all;
+	for (auto &thread : samples)
+	{
+		all.insert(all.end(), thread.begin(), thread.end());
+	}
+	report("owned_value", "load", threads, all, batch);
+}
+
+// The thread counts every benchmark is run with.
+static std::vector<unsigned> thread_counts()
+{
+	std::vector<unsigned> counts = {1, 2, 4};
+	unsigned cores = std::thread::hardware_concurrency();
+	if (cores > 4)
+	{
+		counts.push_back(cores);
+	}
+	return counts;
+}
+
+// A value that remembers being destroyed, so that readers can tell if it was
+// deleted under them even without a sanitizer.
+struct stress_value
+{
+	enum : unsigned
+	{
+		alive = 0x600d,
+		dead = 0xdead
+	};
+	explicit stress_value(int number) : number_(number), canary_(alive) {}
+	~stress_value() { canary_ = dead; }
+	int number_;
+	volatile unsigned canary_;
+};
+
+// The kinds of stress rounds, taken in turn.
+enum class stress_round
+{
+	plain,     // Readers copy, lock and snapshot.
+	moves,     // Readers also move locked readers.
+	async,     // The owner is reset and released asynchronously.
+	reclaimed, // The same, with an owned_reclaimer.
+	handover,  // Thread readers, an owner move, detach_many and a domain.
+	together,  // Readers also lock a registry owner with lock_all and read_all.
+	timed      // The owner is reset and released with time limits.
+};
+
+// Readers pair, copy, lock, snapshot and unlock while the owner is reset,
+// updated and finally released under them. Returns the number of failed
+// checks.
+template <typename Policy> static size_t stress(const char *policy,
+	unsigned threads)
+{
+	typedef owned_ptr<stress_value, Policy> owner_type;
+	typedef reader_ptr<stress_value, Policy> reader_type;
+	std::atomic<size_t> failures(0);
+	auto check = [&failures](const stress_value *value)
+	{
+		if (value != nullptr && value->canary_ != stress_value::alive)
+		{
+			failures.fetch_add(1);
+		}
+	};
+	owned_reclaimer reclaimer;
+	for (size_t round = 0; round < 56; ++round)
+	{
+		stress_round kind = static_cast<stress_round>(round % 7);
+		bool async = kind == stress_round::async ||
+			kind == stress_round::reclaimed;
+		owner_type *owner = new owner_type(new stress_value(0),
+			kind == stress_round::reclaimed || round / 7 % 2 == 1 ?
+			reclaim_mode::deferred : reclaim_mode::blocking);
+		if (kind == stress_round::reclaimed)
+		{
+			owner->set_reclaimer(&reclaimer);
+		}
+		std::vector<reader_type> readers(threads);
+		owner->get_many(readers.begin(), readers.end());
+		thread_reader<stress_value, Policy> *local = nullptr;
+		if (kind == stress_round::handover)
+		{
+			local = new thread_reader<stress_value, Policy>(owner);
+		}
+		owned_ptr<stress_value> *partner = nullptr;
+		std::vector<reader_ptr<stress_value>> partners(threads);
+		if (kind == stress_round::together)
+		{
+			partner = new owned_ptr<stress_value>(new stress_value(0));
+			partner->get_many(partners.begin(), partners.end());
+		}
+		std::atomic<bool> stop(false);
+		std::vector<std::thread> pool;
+		for (unsigned i = 0; i < threads; ++i)
+		{
+			pool.emplace_back([&, i]()
+			{
+				reader_type &reader = readers[i];
+				while (!stop.load(std::memory_order_relaxed))
+				{
+					reader_type copy(reader);
+					stress_value *value = copy.lock();
+					check(value);
+					if (kind == stress_round::moves)
+					{
+						// The lock goes along with each move.
+						reader_type moved(std::move(copy));
+						check(value);
+						copy = std::move(moved);
+						check(value);
+					}
+					copy.unlock();
+					if (kind == stress_round::together)
+					{
+						// Both readers are locked behind a single fence.
+						reader_ptr<stress_value> &also = partners[i];
+						std::tuple<stress_value *, stress_value *> both =
+							lock_all(copy, also);
+						check(std::get<0>(both));
+						check(std::get<1>(both));
+						unlock_all(copy, also);
+						auto guards = read_all(copy, also);
+						check(std::get<0>(guards).get());
+						check(std::get<1>(guards).get());
+					}
+					snapshot<stress_value> held = reader.load();
+					check(held ? &*held : nullptr);
+					if (local != nullptr)
+					{
+						reader_type &mine = local->get();
+						check(mine.lock());
+						mine.unlock();
+					}
+				}
+				if (reader.lock() != nullptr ||
+					partners[i].lock() != nullptr)
+				{
+					failures.fetch_add(1);
+				}
+				reader.unlock();
+				partners[i].unlock();
+			});
+		}
+		for (int i = 1; i < 200; ++i)
+		{
+			if (i == 100 && kind == stress_round::handover)
+			{
+				// The readers move along with the owner.
+				owner_type *moved = new owner_type(std::move(*owner));
+				delete owner;
+				owner = moved;
+			}
+			if (i % 10 == 0)
+			{
+				owner->update([](stress_value &value) { ++value.number_; });
+			}
+			else if (i % 10 == 5)
+			{
+				stress_value *value = new stress_value(i);
+				if (owner->try_reset(value) == reset_status::busy)
+				{
+					delete value;
+				}
+			}
+			else if (async)
+			{
+				owner->reset_async(new stress_value(i));
+			}
+			else if (kind == stress_round::timed)
+			{
+				stress_value *value = new stress_value(i);
+				if (owner->reset_for(value, std::chrono::microseconds(100)) ==
+					reset_status::busy)
+				{
+					delete value;
+				}
+			}
+			else
+			{
+				owner->reset(new stress_value(i));
+			}
+			if (partner != nullptr)
+			{
+				partner->reset(new stress_value(i));
+			}
+		}
+		if (kind == stress_round::handover)
+		{
+			std::vector<reader_type> spare(threads);
+			owner->get_many(spare.begin(), spare.end());
+			owner->detach_many(spare.begin(), spare.end());
+			for (auto &reader : spare)
+			{
+				if (reader.lock() != nullptr)
+				{
+					failures.fetch_add(1);
+				}
+				reader.unlock();
+			}
+			owner_type other(new stress_value(0));
+			owned_domain domain;
+			domain.add(*owner);
+			domain.add(other);
+			domain.release();
+		}
+		else if (async)
+		{
+			owner->release_async().wait();
+		}
+		else if (kind == stress_round::timed)
+		{
+			// Values that are still locked are left to the destructor.
+			while (owner->release_for(std::chrono::milliseconds(1)) ==
+				reset_status::busy) {}
+		}
+		else
+		{
+			delete owner;
+			owner = nullptr;
+		}
+		delete partner;
+		stop.store(true);
+		for (auto &thread : pool)
+		{
+			thread.join();
+		}
+		delete local;
+		delete owner;
+	}
+	std::printf("%-12s %-16s %3u thread(s) %12zu failed\n", policy, "stress",
+		threads, failures.load());
+	return failures.load();
+}
+
+// Readers lock values made in an owned_arena while the owner is reset, and the
+// arena is only released once a domain has released the owner. The values'
+// memory is still there when they are destroyed, so a value destroyed under a
+// reader is always caught by its canary.
+template <typename Policy> static size_t stress_arena(const char *policy,
+	unsigned threads)
+{
+	typedef owned_ptr<stress_value, Policy, arena_delete<stress_value>>
+		owner_type;
+	typedef reader_ptr<stress_value, Policy> reader_type;
+	std::atomic<size_t> failures(0);
+	for (size_t round = 0; round < 8; ++round)
+	{
+		owned_arena arena;
+		owner_type owner(arena.make<stress_value>(0), round % 2 == 1 ?
+			reclaim_mode::deferred : reclaim_mode::blocking);
+		std::vector<reader_type> readers(threads);
+		owner.get_many(readers.begin(), readers.end());
+		std::atomic<bool> stop(false);
+		std::vector<std::thread> pool;
+		for (unsigned i = 0; i < threads; ++i)
+		{
+			pool.emplace_back([&, i]()
+			{
+				reader_type &reader = readers[i];
+				while (!stop.load(std::memory_order_relaxed))
+				{
+					stress_value *value = reader.lock();
+					if (value != nullptr && value->canary_ != stress_value::alive)
+					{
+						failures.fetch_add(1);
+					}
+					reader.unlock();
+				}
+				if (reader.lock() != nullptr)
+				{
+					failures.fetch_add(1);
+				}
+				reader.unlock();
+			});
+		}
+		for (int i = 1; i < 200; ++i)
+		{
+			owner.reset(arena.make<stress_value>(i));
+		}
+		owned_domain domain;
+		domain.add(owner);
+		domain.release();
+		stop.store(true);
+		for (auto &thread : pool)
+		{
+			thread.join();
+		}
+		arena.release();
+	}
+	std::printf("%-12s %-16s %3u thread(s) %12zu failed\n", policy,
+		"stress arena", threads, failures.load());
+	return failures.load();
+}
+
+// A pair whose halves always match, unless a load saw half of a write.
+struct stress_pair
+{
+	std::uintptr_t first_;
+	std::uintptr_t second_;
+};
+
+// Half of the threads write an owned_value while the other half load it.
+static size_t stress_cell(unsigned threads)
+{
+	owned_value<stress_pair> cell;
+	std::atomic<size_t> failures(0);
+	run_threads(threads, [&](unsigned index)
+	{
+		for (std::uintptr_t i = 0; i < 100000; ++i)
+		{
+			if (index % 2 == 0)
+			{
+				std::uintptr_t number = i * threads + index;
+				stress_pair value = {number, number};
+				cell.reset(value);
+			}
+			else
+			{
+				stress_pair value = cell.load();
+				if (value.first_ != value.second_)
+				{
+					failures.fetch_add(1);
+				}
+			}
+		}
+	});
+	std::printf("%-12s %-16s %3u thread(s) %12zu failed\n", "owned_value",
+		"stress", threads, failures.load());
+	return failures.load();
+}
+
+// Readers of a single_thread_policy owner are locked, moved and left locked
+// while the owner is reset, updated and deleted under them. Nothing can wait
+// for them, so the values they hold must outlive the owner's writes.
+static size_t stress_single()
+{
+	typedef owned_ptr<stress_value, single_thread_policy> owner_type;
+	typedef reader_ptr<stress_value, single_thread_policy> reader_type;
+	size_t failures = 0;
+	auto check = [&failures](const stress_value *value)
+	{
+		if (value != nullptr && value->canary_ != stress_value::alive)
+		{
+			++failures;
+		}
+	};
+	for (size_t round = 0; round < 40; ++round)
+	{
+		owner_type *owner = new owner_type(new stress_value(0),
+			round % 2 == 1 ? reclaim_mode::deferred : reclaim_mode::blocking);
+		std::vector<reader_type> readers(2 * OWNED_PTR_RETIRE_LIMIT);
+		owner->get_many(readers.begin(), readers.end());
+		std::vector<stress_value *> locked(readers.size(), nullptr);
+		for (size_t i = 1; i < 200; ++i)
+		{
+			size_t index = (i * 7 + round) % readers.size();
+			if (locked[index] == nullptr)
+			{
+				locked[index] = readers[index].lock();
+			}
+			else
+			{
+				readers[index].unlock();
+				locked[index] = nullptr;
+			}
+			if (i % 3 == 0)
+			{
+				// The lock goes along with each move.
+				reader_type moved(std::move(readers[index]));
+				readers[index] = std::move(moved);
+			}
+			if (i % 10 == 0)
+			{
+				owner->update([](stress_value &value) { ++value.number_; });
+			}
+			else if (i % 10 == 5)
+			{
+				stress_value *value = new stress_value(static_cast<int>(i));
+				if (owner->try_reset(value) == reset_status::busy)
+				{
+					delete value;
+				}
+			}
+			else
+			{
+				owner->reset(new stress_value(static_cast<int>(i)));
+			}
+			for (stress_value *value : locked)
+			{
+				check(value);
+			}
+		}
+		delete owner;
+		for (size_t i = 0; i < readers.size(); ++i)
+		{
+			check(locked[i]);
+			readers[i].unlock();
+		}
+	}
+	std::printf("%-12s %-16s %3u thread(s) %12zu failed\n", "single",
+		"stress", 1u, failures);
+	return failures;
+}
+
+template <typename Policy> static void bench_policy(const char *policy)
+{
+	std::vector<unsigned> counts = thread_counts();
+	for (unsigned threads : counts)
+	{
+		bench_lock<Policy>(policy, threads);
+	}
+	for (unsigned threads : counts)
+	{
+		bench_churn<Policy>(policy, threads);
+	}
+	for (unsigned threads : counts)
+	{
+		bench_local<Policy>(policy, threads);
+	}
+	for (unsigned threads : counts)
+	{
+		bench_reset<Policy>(policy, threads);
+	}
+	for (unsigned threads : counts)
+	{
+		bench_destroy<Policy>(policy, threads);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && std::strcmp(argv[1], "stress") == 0)
+	{
+		unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+		size_t failures = stress<registry_policy>("registry", threads) +
+			stress<counted_policy>("counted", threads) +
+			stress<sharded_policy<8>>("sharded<8>", threads) +
+			stress_arena<registry_policy>("registry", threads) +
+			stress_arena<counted_policy>("counted", threads) +
+			stress_arena<sharded_policy<8>>("sharded<8>", threads) +
+			stress_cell(threads) + stress_single();
+		return failures == 0 ? 0 : 1;
+	}
+	bench_policy<registry_policy>("registry");
+	bench_policy<counted_policy>("counted");
+	bench_policy<sharded_policy<8>>("sharded<8>");
+	for (unsigned threads : thread_counts())
+	{
+		bench_value(threads);
+	}
+	return 0;
+}
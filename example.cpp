@@ -37,6 +37,30 @@ int main()
 	std::cout << "New Value: " << (*owned_ref.lock()) << std::endl;
 	owned_ref.unlock();
 
+	// Or let a guard unlock when it goes out of scope.
+	{
+		read_guard<int> guard = owned_ref.read();
+		if (guard)
+		{
+			std::cout << "Guarded Value: " << (*guard) << std::endl;
+		}
+	}
+
+	// Or copy the value out, which keeps the owner waiting only for the copy.
+	int copied = 0;
+	if (owned_ref.copy(copied))
+	{
+		std::cout << "Copied Value: " << copied << std::endl;
+	}
+
+	// Owners can be moved, and their readers move with them.
+	{
+		owned_ptr<int> moved_owner(std::move(*owner));
+		std::cout << "Moved Value: " << (*owned_ref.lock()) << std::endl;
+		owned_ref.unlock();
+		*owner = std::move(moved_owner);
+	}
+
 	// Delete the owner, therefore deleting children references.
 	delete owner;
 
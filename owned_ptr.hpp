@@ -23,12 +23,25 @@
 **/
 #ifndef OWNED_PTR__HPP_
 #define OWNED_PTR__HPP_
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <ctime>
+#include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <system_error>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <cassert>
-#include <deque>
-#include <list>
 
 // A macro to disallow the copy constructor and operator= functions
 // This should be used in the private: declarations for a class
@@ -36,8 +49,503 @@
 	TypeName(const TypeName&); \
 	void operator=(const TypeName&)
 
+// The number of values an owned_ptr in reclaim_mode::deferred can keep
+// retired at once. Retired values are stored inside the owner, so retiring
+// a value never allocates.
+#ifndef OWNED_PTR_RETIRE_LIMIT
+#define OWNED_PTR_RETIRE_LIMIT 8
+#endif
 
-template <typename Type> class reader_ptr;
+// The distance in bytes that keeps two atomics written by different threads
+// from sharing a cache line. Define OWNED_PTR_INTERFERENCE_SIZE to use the
+// standard library's value where it has one. It is not the default, as that
+// value may change with the compiler's version and tuning flags, and the
+// application and its plugins must agree on the layout of owners.
+#ifndef OWNED_PTR_CACHE_LINE
+#if defined(OWNED_PTR_INTERFERENCE_SIZE) && \
+	defined(__cpp_lib_hardware_interference_size)
+#define OWNED_PTR_CACHE_LINE std::hardware_destructive_interference_size
+#else
+#define OWNED_PTR_CACHE_LINE 64
+#endif
+#endif
+
+// Set to 0 to leave out the padding that keeps fields written by different
+// threads on their own cache lines, for hosts that are short on memory. Every
+// owner and control block is then smaller, at the cost of false sharing.
+#ifndef OWNED_PTR_PADDING
+#define OWNED_PTR_PADDING 1
+#endif
+
+// The size in bytes of each block an owned_arena allocates values from.
+#ifndef OWNED_PTR_ARENA_CHUNK
+#define OWNED_PTR_ARENA_CHUNK 65536
+#endif
+
+// The number of owners' retired values and async calls an owned_reclaimer
+// keeps at once by default. Past that, owners delete their values themselves.
+#ifndef OWNED_PTR_RECLAIM_LIMIT
+#define OWNED_PTR_RECLAIM_LIMIT 1024
+#endif
+
+// The largest type in bytes that an owned_value may hold. Readers copy the
+// whole value, and copy it again if a writer changed it meanwhile.
+#ifndef OWNED_PTR_VALUE_LIMIT
+#define OWNED_PTR_VALUE_LIMIT 64
+#endif
+
+// Define OWNED_PTR_ENABLE_STATS to count how long owners wait for readers, as
+// reported by owned_stats. It adds a field to every owner and reader, so the
+// application and its plugins must agree on it. Without it, nothing is counted.
+#ifdef OWNED_PTR_ENABLE_STATS
+struct owned_stats;
+#endif
+
+// Define OWNED_PTR_TRACE_BEGIN(name, object) and OWNED_PTR_TRACE_END(name,
+// object) to trace the spans where writers wait for readers, for example with
+// a callback, an ETW event or a USDT probe. The name is a string literal, such
+// as "owned_ptr::reset", and the object is the address of the owner, domain or
+// reader the span is about. The spans of owners and domains end on the thread
+// they began on, and may nest. Define OWNED_PTR_TRACE_READS as well to trace
+// how long each read_guard keeps its value locked.
+#ifndef OWNED_PTR_TRACE_BEGIN
+#define OWNED_PTR_TRACE_BEGIN(name, object) ((void)(name), (void)(object))
+#endif
+#ifndef OWNED_PTR_TRACE_END
+#define OWNED_PTR_TRACE_END(name, object) ((void)(name), (void)(object))
+#endif
+
+namespace owned_detail
+{
+
+/**
+ * @brief  Puts writers to sleep while they wait for readers to unlock.
+ *
+ * A writer first spins and yields for a short while, then marks itself as
+ * waiting and sleeps on a bucket of a fixed table hashed by address. A reader
+ * that sees the mark wakes the bucket. The table is static, so waking never
+ * touches the owner, which may be deleted as soon as the writer sees the
+ * reader unlock.
+ *
+ * Sleeps are bounded, starting at one millisecond and backing off to 16, so a
+ * missed wake-up costs latency instead of a hang.
+ * This covers readers that check the mark without a full fence, and plugins
+ * that were linked with their own copy of the table.
+ */
+class parking
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	template <typename Flag, typename Ready> static void wait(const void *key,
+		Flag &waiting, Ready ready);
+	template <typename Flag, typename Ready> static bool wait_until(
+		const void *key, Flag &waiting, Ready ready,
+		const clock::time_point &deadline);
+	static void notify(const void *key);
+	template <typename Clock, typename Duration> static clock::time_point
+		deadline(const std::chrono::time_point<Clock, Duration> &time);
+	static clock::time_point deadline(const clock::time_point &time);
+private:
+	struct bucket
+	{
+		std::mutex mutex_;
+		std::condition_variable ready_;
+	};
+	static bucket &bucket_(const void *key);
+	static void spun_(unsigned count);
+	static void parked_();
+	enum
+	{
+		spin_limit_ = 128,
+		yield_limit_ = 16,
+		bucket_count_ = 64,
+		sleep_limit_us_ = 16000
+	};
+};
+
+#ifdef OWNED_PTR_ENABLE_STATS
+/**
+ * @brief  The counters behind owned_ptr::stats() and owned_global_stats().
+ *
+ * Each owner counts its own waits, and adds them to the global counters too.
+ * Spins, parks and lock hold times are only counted globally, as parking and
+ * readers do not know their owner.
+ */
+class stats
+{
+public:
+	stats();
+	void readers(size_t count);
+	void wait(bool destroy, parking::clock::duration time);
+	void read(owned_stats &out) const;
+	static stats &global();
+	static void spun(unsigned spins, unsigned yields);
+	static void parked();
+	static void held(const void *reader, parking::clock::duration time);
+	static void read_global(owned_stats &out);
+private:
+	DISALLOW_COPY_AND_ASSIGN(stats);
+	struct contention
+	{
+		std::atomic<std::uint64_t> spins_;
+		std::atomic<std::uint64_t> yields_;
+		std::atomic<std::uint64_t> parks_;
+		std::atomic<std::uint64_t> hold_max_ns_;
+		std::mutex mutex_;
+		const void *hold_max_reader_;
+	};
+	static contention &contention_();
+	static void max_(std::atomic<std::uint64_t> &max, std::uint64_t value);
+	enum
+	{
+		buckets_ = 16
+	};
+	void record_(bool destroy, std::uint64_t ns);
+	std::atomic<std::uint64_t> readers_peak_;
+	std::atomic<std::uint64_t> reset_waits_[buckets_];
+	std::atomic<std::uint64_t> destroy_waits_[buckets_];
+	std::atomic<std::uint64_t> wait_ns_;
+	std::atomic<std::uint64_t> wait_max_ns_;
+};
+#endif
+
+/**
+ * @brief  Traces a span from its construction to its destruction.
+ */
+class trace_span
+{
+public:
+	trace_span(const char *name, const void *object);
+	~trace_span();
+private:
+	DISALLOW_COPY_AND_ASSIGN(trace_span);
+	const char *name_;
+	const void *object_;
+};
+
+/**
+ * @brief  A bit of an atomic word, used by parking as the waiting mark.
+ */
+class word_flag
+{
+public:
+	word_flag(std::atomic<std::uintptr_t> &word, std::uintptr_t bit);
+	void store(bool value, std::memory_order order);
+private:
+	std::atomic<std::uintptr_t> &word_;
+	std::uintptr_t bit_;
+};
+
+/**
+ * @brief  A waiting mark that the caller sets and clears itself, used by
+ *         parking when the marks are kept elsewhere.
+ */
+class null_flag
+{
+public:
+	void store(bool value, std::memory_order order);
+};
+
+/**
+ * @brief  A value shared by snapshots, deleted by whoever lets go of it last.
+ */
+template <typename Type> struct pin
+{
+	std::atomic<size_t> refs_;
+	Type *value_;
+	pin<Type> *next_;
+	void (*destroy_)(pin<Type> *held);
+	void *deleter_[2];
+};
+
+/**
+ * @brief  A pin with its value, made in a single allocation by emplace().
+ */
+template <typename Type> struct pin_block
+{
+	pin<Type> pin_;
+	typename std::aligned_storage<sizeof(Type),
+		std::alignment_of<Type>::value>::type storage_;
+};
+
+/**
+ * @brief  A mutex that does nothing, for single_thread_policy.
+ */
+class null_mutex
+{
+public:
+	void lock();
+	void unlock();
+	bool try_lock();
+};
+
+/**
+ * @brief  A value with std::atomic's load() and store(), but no atomicity.
+ */
+template <typename Value> class plain_atomic
+{
+public:
+	plain_atomic(Value value);
+	Value load(std::memory_order order) const;
+	void store(Value value, std::memory_order order);
+private:
+	Value value_;
+};
+
+/**
+ * @brief  How a pin_table is shared between threads.
+ */
+struct shared_sync
+{
+	typedef std::mutex mutex;
+	template <typename Value> using atomic = std::atomic<Value>;
+};
+
+/**
+ * @brief  A pin_table used by a single thread, without locks or atomics.
+ */
+struct single_sync
+{
+	typedef null_mutex mutex;
+	template <typename Value> using atomic = plain_atomic<Value>;
+};
+
+/**
+ * @brief  Keeps the pins of an owner's values.
+ *
+ * A pin is made for the current value the first time it is snapshotted, or
+ * with the value by make(), and the owner holds one reference to it. Once the
+ * owner is done with the value, dispose() drops that reference instead of
+ * deleting the value, and the pin leaves the table. Only acquire() and
+ * dispose() lock the table, so publishing costs one store, and a snapshot
+ * never waits for a writer that is waiting for readers.
+ */
+template <typename Type, typename Sync = shared_sync> class pin_table
+{
+public:
+	explicit pin_table(Type *value);
+	pin<Type> *acquire();
+	pin<Type> *keep(Type *value);
+	void publish(Type *value);
+	template <typename Deleter> void dispose(Type *value, Deleter &deleter);
+	void adopt(pin<Type> *held);
+	void take(pin_table<Type, Sync> &other);
+	template <typename... Args> static pin<Type> *make(Args &&... args);
+	static void release(pin<Type> *held);
+private:
+	DISALLOW_COPY_AND_ASSIGN(pin_table);
+	static void destroy_(pin<Type> *held);
+	static void destroy_block_(pin<Type> *held);
+	template <typename Deleter> static void destroy_with_(pin<Type> *held);
+	typename Sync::mutex mutex_;
+	typename Sync::template atomic<Type*> value_;
+	typename Sync::template atomic<pin<Type>*> pins_;
+};
+
+/**
+ * @brief  Holds a deleter, taking no space if the deleter has no state.
+ */
+template <typename Deleter, bool Empty = std::is_empty<Deleter>::value>
+	class deleter_base : private Deleter
+{
+public:
+	explicit deleter_base(const Deleter &deleter);
+	Deleter &deleter();
+	const Deleter &deleter() const;
+};
+
+template <typename Deleter> class deleter_base<Deleter, false>
+{
+public:
+	explicit deleter_base(const Deleter &deleter);
+	Deleter &deleter();
+	const Deleter &deleter() const;
+private:
+	Deleter deleter_;
+};
+
+}
+
+struct registry_policy;
+template <typename Type, typename Policy = registry_policy,
+	typename Deleter = std::default_delete<Type>> class owned_ptr;
+template <typename Type, typename Policy = registry_policy> class reader_ptr;
+template <typename Type, typename Policy = registry_policy> class read_guard;
+template <typename Type> class snapshot;
+template <typename Type, typename Policy = registry_policy> class thread_reader;
+class owned_domain;
+class owned_reclaimer;
+
+/**
+ * @brief  How an owned_ptr frees a value that readers may still be using.
+ */
+enum class reclaim_mode
+{
+	/**
+	 * @brief  reset() waits until no reader holds the old value, then deletes
+	 *         it before returning.
+	 */
+	blocking,
+
+	/**
+	 * @brief  reset() publishes the new value and returns immediately. Old
+	 *         values still held by readers are retired and deleted by a later
+	 *         call to reset() or collect(), by the owner's owned_reclaimer,
+	 *         or by the destructor.
+	 */
+	deferred
+};
+
+/**
+ * @brief  The result of owned_ptr's non-blocking and timed functions.
+ */
+enum class reset_status
+{
+	/**
+	 * @brief  Readers let go of the old value in time, and it was deleted.
+	 */
+	done,
+
+	/**
+	 * @brief  The new value was published, but the old value is still locked.
+	 *
+	 * The old value is retired and deleted by collect(), a later reset() or
+	 * the destructor.
+	 */
+	retired,
+
+	/**
+	 * @brief  Nothing was changed, and the caller still owns the given value.
+	 *
+	 * Either OWNED_PTR_RETIRE_LIMIT values stayed retired and locked until the
+	 * time limit, so the old value could not be retired, or the policy could
+	 * not get ready to publish in time. For sharded_policy, that happens while
+	 * readers still hold the value from before the current one.
+	 */
+	busy
+};
+
+#ifdef OWNED_PTR_ENABLE_STATS
+/**
+ * @brief  What owners have waited for, from owned_ptr::stats() or
+ *         owned_global_stats().
+ *
+ * Only declared with OWNED_PTR_ENABLE_STATS. Times are in nanoseconds. Bucket
+ * i of a histogram counts the waits shorter than 2^i microseconds that are not
+ * counted by a lower bucket, and the last bucket also counts all longer waits.
+ * The spins, parks and lock hold times are only counted globally, and are zero
+ * in an owner's stats.
+ */
+struct owned_stats
+{
+	enum
+	{
+		buckets = 16
+	};
+
+	/**
+	 * @brief  The most readers seen at once, counted as readers are paired.
+	 */
+	size_t readers_peak;
+
+	/**
+	 * @brief  How long reset() and the other writers waited for readers.
+	 */
+	std::uint64_t reset_waits[buckets];
+
+	/**
+	 * @brief  How long the destructor and release_until() waited for readers.
+	 */
+	std::uint64_t destroy_waits[buckets];
+
+	/**
+	 * @brief  The total and the longest time waited for readers.
+	 */
+	std::uint64_t wait_ns;
+	std::uint64_t wait_max_ns;
+
+	/**
+	 * @brief  How often a waiting writer checked the readers again, yielded
+	 *         before checking, or went to sleep.
+	 */
+	std::uint64_t spins;
+	std::uint64_t yields;
+	std::uint64_t parks;
+
+	/**
+	 * @brief  The longest time a reader kept its value locked, and the address
+	 *         of the reader_ptr that did.
+	 */
+	std::uint64_t hold_max_ns;
+	const void *hold_max_reader;
+};
+#endif
+
+/**
+ * @brief  The default policy, where an owner keeps a registry of its readers.
+ *
+ * Readers publish the value they are using in a per-reader hazard slot, so
+ * reading never takes a lock. Writers publish the new value to every reader,
+ * then wait only for the readers whose slot still holds the old value. Any
+ * number of values can be retired at once in reclaim_mode::deferred, up to
+ * OWNED_PTR_RETIRE_LIMIT.
+ */
+struct registry_policy
+{
+	template <typename Type> class owner;
+	template <typename Type> class reader;
+};
+
+/**
+ * @brief  A policy where an owner only counts its locked readers.
+ *
+ * Readers do not register with the owner. They share a small control block
+ * that holds the value, a generation number and one reader count for each
+ * parity of the generation. reset() moves to the next generation and waits
+ * only for the readers counted under the previous one. get() and the reader's
+ * destructor cost one atomic operation and never take the owner's lock, and a
+ * reader is two words in size.
+ *
+ * Each count is split into Shards counters, each on its own cache line. A
+ * thread always counts itself in the same shard, so readers on different
+ * threads do not write to the same line. Writers check every shard, so more
+ * shards make reset() and the destructor slower.
+ *
+ * Because there are only two counts, the readers of a value must have left
+ * before the generation after next can start. In reclaim_mode::deferred, this
+ * means reset() waits for the value retired by the previous reset().
+ */
+template <std::size_t Shards> struct sharded_policy
+{
+	static_assert(Shards > 0, "sharded_policy needs at least one shard");
+	template <typename Type> class owner;
+	template <typename Type> class reader;
+};
+
+/**
+ * @brief  A reader-count-only policy with a single shard.
+ *
+ * @see    sharded_policy
+ */
+typedef sharded_policy<1> counted_policy;
+
+/**
+ * @brief  A policy for owners and readers that are only used by one thread.
+ *
+ * Nothing is locked and nothing is atomic, other than the counts of
+ * snapshots. Readers read the owner's value directly and are kept in a list,
+ * so as in registry_policy, up to OWNED_PTR_RETIRE_LIMIT values can be
+ * retired at a time. Because no other thread can unlock a reader, writers
+ * never wait: a value that a blocking reset() or the owner's destructor would
+ * wait for is handed to the readers that have it locked instead, and deleted
+ * once the last of them lets go. Handing a value over allocates, as a
+ * snapshot does.
+ */
+struct single_thread_policy
+{
+	template <typename Type> class owner;
+	template <typename Type> class reader;
+};
 
 /**
  * @brief  A smart pointer whose data is read from a reader_ptr.
@@ -47,288 +555,4389 @@ template <typename Type> class reader_ptr;
  * removed (the library is unloaded during run-time) and used memory is not
  * tracked or cannot be determined.
  *
- * This class is thread safe.
+ * This class is thread safe. How readers are tracked is chosen by the Policy,
+ * either registry_policy (the default), counted_policy or sharded_policy.
+ * Values are deleted by the Deleter, so that they can be given back to the
+ * heap they came from. A deleter without state takes no space. A copy of the
+ * deleter is kept with any value that snapshots may still hold, so it must
+ * fit in two pointers.
  */
-template <typename Type> class owned_ptr
+template <typename Type, typename Policy, typename Deleter> class owned_ptr :
+	private owned_detail::deleter_base<Deleter>
+{
+public:
+
+	/**
+	 * @brief  Creates an instance without a value.
+	 */
+	owned_ptr();
+
+	/**
+	 * @brief  Creates an instance with the given value.
+	 *
+	 * The given variable is owned by the owned_ptr instance. It is managed and
+	 * deleted by this instance.
+	 */
+	explicit owned_ptr(Type *value,
+		reclaim_mode mode = reclaim_mode::blocking,
+		const Deleter &deleter = Deleter());
+
+	/**
+	 * @brief  Creates an instance by taking the given owner's value, readers
+	 *         and retired values.
+	 *
+	 * The readers keep reading the same value, now owned by this instance, and
+	 * the given owner is left as if made with the default constructor. An
+	 * owned_domain still refers to the given owner, not to this one.
+	 *
+	 * Readers may be used while their owner is moved, but neither owner may be
+	 * used by another thread until the move is done.
+	 */
+	owned_ptr(owned_ptr<Type, Policy, Deleter> &&other);
+
+	/**
+	 * @brief  Deallocates associated data and invalidates all readers.
+	 *
+	 * If a reader is currently accessing the values, then this function will
+	 * wait for the reader to be unlocked before deleting. Retired values are
+	 * also waited on and deleted, and unfinished release_async() and
+	 * reset_async() calls are waited for.
+	 *
+	 * Snapshots are not waited for. A value that a snapshot still holds is
+	 * deleted later, with a copy of the deleter, by whichever thread drops
+	 * its last snapshot. Drop every snapshot before the code or memory that
+	 * the deleter and the value need is unloaded.
+	 */
+	~owned_ptr();
+
+	/**
+	 * @brief  Deletes this instance's values as the destructor does, then takes
+	 *         the given owner's value, readers and retired values.
+	 *
+	 * The readers of this instance are left without an owner. As with the
+	 * move constructor, neither owner may be used by another thread meanwhile.
+	 */
+	owned_ptr<Type, Policy, Deleter> &operator=(
+		owned_ptr<Type, Policy, Deleter> &&other);
+
+	/**
+	 * @brief  Pairs the reader instance with this instance.
+	 *
+	 * If the given reader is already locked, then the reader will not be able
+	 * to obtain its new value until it makes another call to lock().
+	 */
+	void get(reader_ptr<Type, Policy> &reader);
+
+	/**
+	 * @brief  Pairs every reader in the given range with this owner.
+	 *
+	 * The same as calling get() with each reader, but the owner is locked only
+	 * once. The range must hold distinct reader_ptr instances.
+	 */
+	template <typename Iterator> void get_many(Iterator first, Iterator last);
+
+	/**
+	 * @brief  Unpairs every reader in the given range from this owner.
+	 *
+	 * Each reader is unlocked and left without an owner, as if it was created
+	 * with the default constructor. Readers of other owners are left alone.
+	 * The owner is locked only once.
+	 */
+	template <typename Iterator> void detach_many(Iterator first,
+		Iterator last);
+
+	/**
+	 * @brief  Changes the value type.
+	 *
+	 * This function is blocked until no readers are using the old value. Readers
+	 * that lock after the new value is published are not waited on. The given
+	 * variable is owned by this instance. It is managed and deleted by this
+	 * instance.
+	 *
+	 * In reclaim_mode::deferred, this function does not wait. An old value that
+	 * is still locked is retired instead, and other retired values that are no
+	 * longer locked are deleted. If OWNED_PTR_RETIRE_LIMIT values are already
+	 * retired and locked, this function waits until one of them is unlocked.
+	 * In either mode, retired values that are no longer locked are deleted.
+	 *
+	 * This function does not allocate, unless there is a reclaimer to give
+	 * the old value to, or a single_thread_policy reader still has it locked.
+	 */
+	void reset(Type *value);
+
+	/**
+	 * @brief  Changes the value to one made from the given arguments.
+	 *
+	 * The same as reset(), except that the value is made in a single
+	 * allocation together with the count that snapshots of it share.
+	 */
+	template <typename... Args> void emplace(Args &&... args);
+
+	/**
+	 * @brief  Replaces the value with a changed copy of it.
+	 * @return Whether there was a value to copy.
+	 *
+	 * The current value is copied, the copy is given to the function to
+	 * change, and then published as with reset(). Concurrent updates are run
+	 * one after another, so none is lost. The old value is retired as in
+	 * reclaim_mode::deferred, whatever the mode of this instance, so readers
+	 * are not waited on. If the function throws, nothing is changed.
+	 */
+	template <typename Function> bool update(Function function);
+
+	/**
+	 * @brief  Changes the value without waiting for readers.
+	 * @see    reset_until()
+	 */
+	reset_status try_reset(Type *value);
+
+	/**
+	 * @brief  Changes the value, waiting at most the given time for readers.
+	 * @see    reset_until()
+	 */
+	template <typename Rep, typename Period> reset_status reset_for(
+		Type *value, const std::chrono::duration<Rep, Period> &timeout);
+
+	/**
+	 * @brief  Changes the value, waiting for readers until the given time.
+	 * @return Whether the old value was deleted, retired, or not replaced.
+	 *
+	 * Unlike reset(), this function behaves the same in either reclaim_mode, and
+	 * never waits past the given time. If a value is not taken because the
+	 * retire list stayed full, reset_status::busy is returned and the caller
+	 * still owns it.
+	 */
+	template <typename Clock, typename Duration> reset_status reset_until(
+		Type *value, const std::chrono::time_point<Clock, Duration> &deadline);
+
+	/**
+	 * @brief  Invalidates all readers, waiting at most the given time for them.
+	 * @see    release_until()
+	 */
+	template <typename Rep, typename Period> reset_status release_for(
+		const std::chrono::duration<Rep, Period> &timeout);
+
+	/**
+	 * @brief  Invalidates all readers, waiting for them until the given time.
+	 * @return reset_status::done if the value and every retired value have been
+	 *         unlocked and deleted, reset_status::retired if some are still
+	 *         locked, or reset_status::busy if readers were not invalidated.
+	 *
+	 * This is the destructor's work with a time limit. Values that are still
+	 * locked are deleted by collect(), a later reset() or the destructor. The
+	 * owner is left without a value, and can be given a new one with reset().
+	 */
+	template <typename Clock, typename Duration> reset_status release_until(
+		const std::chrono::time_point<Clock, Duration> &deadline);
+
+	/**
+	 * @brief  Invalidates all readers, and deletes the values on another thread
+	 *         once the readers let go of them.
+	 * @return A future that is ready once every value has been deleted.
+	 *
+	 * Readers see no value as soon as this function returns, but it does not
+	 * wait for them. If a reader still holds a value, a thread of its own waits
+	 * and deletes, so owners released together do not wait on each other. The
+	 * owner can be given a new value meanwhile, but should only be destroyed
+	 * once the future is ready, as its destructor waits otherwise.
+	 *
+	 * With sharded_policy, publishing still waits for the readers of the value
+	 * before the current one, as reset() does. single_thread_policy has no
+	 * other thread to wait on, and does not compile this function.
+	 */
+	std::future<void> release_async();
+
+	/**
+	 * @brief  The same as release_async(), but calls the given function once
+	 *         every value has been deleted.
+	 *
+	 * The function is called on the thread that deleted the last value, which
+	 * may be this one, and must not throw. It may destroy the owner.
+	 */
+	template <typename Function> void release_async(Function done);
+
+	/**
+	 * @brief  Changes the value, and deletes the old value on another thread
+	 *         once the readers let go of it.
+	 * @return A future that is ready once the old value has been deleted.
+	 * @see    release_async()
+	 *
+	 * Whatever the reclaim_mode, this function does not wait for readers. As
+	 * release_async(), it does not compile with single_thread_policy.
+	 */
+	std::future<void> reset_async(Type *value);
+
+	/**
+	 * @brief  The same as reset_async(), but calls the given function once the
+	 *         old value has been deleted.
+	 * @see    release_async()
+	 */
+	template <typename Function> void reset_async(Type *value, Function done);
+
+	/**
+	 * @brief  Lets the given reclaimer delete the old values of this owner.
+	 *
+	 * In reclaim_mode::deferred, reset() and update() then retire every old
+	 * value, and leave deleting retired values to the reclaimer instead of
+	 * deleting them when readers let go. While the reclaimer has not yet caught
+	 * up with OWNED_PTR_RETIRE_LIMIT retired values, an old value is not
+	 * retired, but waited on and deleted as without a reclaimer. release_async()
+	 * and reset_async() give their work to the reclaimer instead of starting a
+	 * thread. The reclaimer must outlive this owner, and may be set before
+	 * other threads use it. As release_async(), it does not compile with
+	 * single_thread_policy.
+	 */
+	void set_reclaimer(owned_reclaimer *reclaimer);
+
+	/**
+	 * @brief  Deletes retired values that are no longer locked by any reader.
+	 * @return The number of retired values that are still locked.
+	 *
+	 * This function never waits for readers. It is only useful with
+	 * reclaim_mode::deferred, and may be called from any thread.
+	 */
+	size_t collect();
+
+	/**
+	 * @brief  Returns the number of readers.
+	 */
+	size_t count();
+
+	/**
+	 * @brief  Returns the number of readers that have a value locked.
+	 *
+	 * This is meant for finding out why reset() or the destructor are waiting,
+	 * and may already be out of date when it returns.
+	 */
+	size_t count_locked();
+
+	/**
+	 * @brief  Returns the reclamation mode given on construction.
+	 */
+	reclaim_mode mode() const;
+
+	/**
+	 * @brief  Returns the deleter that values are deleted with.
+	 */
+	Deleter &get_deleter();
+	const Deleter &get_deleter() const;
+
+#ifdef OWNED_PTR_ENABLE_STATS
+	/**
+	 * @brief  Returns how much this owner has waited for its readers.
+	 *
+	 * Only declared with OWNED_PTR_ENABLE_STATS. An owner that is moved from
+	 * keeps its stats.
+	 */
+	owned_stats stats() const;
+#endif
+
+protected:
+	friend class owned_domain;
+	typedef typename Policy::template owner<Type> core_type;
+	typedef typename core_type::mutex_type mutex_type;
+	typedef owned_detail::parking::clock::time_point time_point;
+	Type *invalidate_();
+	void drain_(Type *old);
+	Type *withdraw_();
+	void redrain_(Type *old);
+	void dispose_(Type *value);
+	Type *retire_(Type *old);
+	size_t collect_();
+	bool reserve_until_(const time_point &deadline);
+	reset_status reset_until_(Type *value, const time_point &deadline);
+	reset_status release_until_(const time_point &deadline);
+	void take_(owned_ptr<Type, Policy, Deleter> &other);
+	void wait_(Type *value, bool destroy);
+	bool wait_until_(Type *value, const time_point &deadline, bool destroy);
+	template <typename Poll, typename Function> void run_async_(Poll poll,
+		Function done);
+	static void finish_async_(std::atomic<std::uintptr_t> *count);
+	void wait_async_();
+	bool reclaim_();
+	bool collect_async_();
+	core_type core_;
+private:
+	DISALLOW_COPY_AND_ASSIGN(owned_ptr);
+	static_assert(sizeof(Deleter) <= 2 * sizeof(void *) &&
+		std::alignment_of<Deleter>::value <= std::alignment_of<void *>::value,
+		"owned_ptr needs a deleter that fits in two pointers");
+	enum : std::uintptr_t
+	{
+		async_waiting_ = 1,
+		async_task_ = 2
+	};
+	Type *retired_[OWNED_PTR_RETIRE_LIMIT];
+	size_t retired_count_;
+	reclaim_mode mode_;
+
+	// The number of unfinished async tasks, in units of async_task_.
+	std::atomic<std::uintptr_t> async_;
+	owned_reclaimer *reclaimer_;
+
+	// Whether the retired values are queued with the reclaimer.
+	bool queued_;
+#ifdef OWNED_PTR_ENABLE_STATS
+	owned_detail::stats stats_;
+#endif
+};
+
+/**
+ * @brief  A class that reads data from a referenced owned pointer.
+ */
+template <typename Type, typename Policy> class reader_ptr
+{
+public:
+
+	/**
+	 * @brief  Creates an instance without a referenced owner.
+	 */
+	reader_ptr();
+
+	/**
+	 * @brief  Creates an instance with a referenced owner.
+	 */
+	template <typename Deleter> explicit reader_ptr(
+		owned_ptr<Type, Policy, Deleter> *owner);
+
+	/**
+	 * @brief  Creates an instance with the same owner as the given reader.
+	 */
+	reader_ptr(reader_ptr<Type, Policy> &other);
+
+	/**
+	 * @brief  Creates an instance by replacing the given reader.
+	 */
+	reader_ptr(reader_ptr<Type, Policy> &&other);
+
+	/**
+	 * @brief  Leaves the current owner, and replaces the given reader.
+	 *
+	 * Like the move constructor, this never allocates, and takes at most the
+	 * owner's lock.
+	 */
+	reader_ptr<Type, Policy> &operator=(reader_ptr<Type, Policy> &&other);
+
+	/**
+	 * @brief  Locks the owner's value.
+	 * @return The owner's value if the owner still exists, or nullptr if there
+	 *         is no owner, or the owner has been deleted.
+	 * @see    unlock();
+	 *
+	 * Multiple readers may lock simultaneously. If an owner's value has
+	 * changed after calling this method, then this method must be called again
+	 * to recieve the new value.
+	 *
+	 * This method is lock-free. It retries only if a writer publishes a new
+	 * value at the same time.
+	 */
+	Type *lock();
+
+	/**
+	 * @brief  Unlocks the owner's value.
+	 */
+	void unlock();
+
+	/**
+	 * @brief  Locks the owner's value until the returned guard is destroyed.
+	 * @see    lock();
+	 */
+	read_guard<Type, Policy> read();
+
+	/**
+	 * @brief  Takes a snapshot of the owner's value.
+	 * @return A snapshot of the owner's value, or an empty snapshot if there
+	 *         is no owner, or the owner has been deleted.
+	 * @see    snapshot
+	 *
+	 * A snapshot does not keep writers waiting, but costs more to take than
+	 * lock(). This reader's lock is left as it is. The snapshot may outlive
+	 * the owner, and then deletes the value itself, as snapshot describes.
+	 */
+	snapshot<Type> load();
+
+	/**
+	 * @brief  Copies the owner's value into the given variable.
+	 * @return Whether there was a value to copy. If not, the variable is left
+	 *         as it is.
+	 * @see    lock()
+	 *
+	 * The value is copied under a lock that is dropped as soon as the copy is
+	 * done, so reset() and the destructor wait at most for the copy, and the
+	 * value is never deleted by this thread, unlike with load(). This suits
+	 * monitoring threads that must not add to reload latency. As with lock(),
+	 * this replaces the reader's lock, and the reader is left unlocked.
+	 */
+	bool copy(Type &out);
+
+protected:
+	template <typename, typename, typename> friend class owned_ptr;
+	friend typename Policy::template owner<Type>;
+	template <typename... Types, typename... Policies>
+		friend std::tuple<Types *...> lock_all(
+		reader_ptr<Types, Policies> &... readers);
+	typedef typename Policy::template reader<Type> core_type;
+	void stage_();
+	Type *confirm_();
+	core_type core_;
+#ifdef OWNED_PTR_ENABLE_STATS
+private:
+	void held_();
+	owned_detail::parking::clock::time_point locked_at_;
+#endif
+};
+
+/**
+ * @brief  Keeps a reader's value locked for as long as it exists.
+ *
+ * The value is locked on construction and unlocked on destruction, so a
+ * forgotten unlock() cannot keep the owner's writers waiting. A guard can be
+ * moved, but not copied. The reader must outlive its guard, and should not be
+ * locked or unlocked by hand meanwhile.
+ */
+template <typename Type, typename Policy> class read_guard
+{
+public:
+
+	/**
+	 * @brief  Creates an instance without a locked reader.
+	 */
+	read_guard();
+
+	/**
+	 * @brief  Creates an instance by locking the given reader.
+	 */
+	explicit read_guard(reader_ptr<Type, Policy> &reader);
+
+	/**
+	 * @brief  Creates an instance by taking over the given guard's lock.
+	 */
+	read_guard(read_guard<Type, Policy> &&other);
+
+	/**
+	 * @brief  Unlocks the reader, if any.
+	 */
+	~read_guard();
+
+	/**
+	 * @brief  Unlocks the reader, if any, and takes over the given guard's lock.
+	 */
+	read_guard<Type, Policy> &operator=(read_guard<Type, Policy> &&other);
+
+	/**
+	 * @brief  Unlocks the reader before the guard is destroyed.
+	 */
+	void unlock();
+
+	/**
+	 * @brief  Returns the locked value, or nullptr if the owner is gone.
+	 */
+	Type *get() const;
+
+	Type &operator*() const;
+	Type *operator->() const;
+
+	/**
+	 * @brief  Returns whether the locked value is valid.
+	 */
+	explicit operator bool() const;
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(read_guard);
+	reader_ptr<Type, Policy> *reader_;
+	Type *value_;
+};
+
+/**
+ * @brief  Keeps a value alive after its owner has moved on from it.
+ *
+ * Unlike a lock, a snapshot does not keep reset() or the owner's destructor
+ * waiting. The value is deleted by whichever of the owner and the last copy of
+ * its snapshots lets go of it last, in that thread. Snapshots are meant for
+ * long reads: the first snapshot of each value allocates, and taking one locks
+ * a mutex.
+ *
+ * A snapshot may therefore outlive its owner, an owned_domain::release() and
+ * the plugin's unloading. Its last copy then runs a copy of the owner's
+ * deleter on its own thread. Every snapshot of a plugin's values must be
+ * dropped before that plugin's code, heap or owned_arena goes away.
+ */
+template <typename Type> class snapshot
+{
+public:
+
+	/**
+	 * @brief  Creates an empty instance.
+	 */
+	snapshot();
+
+	/**
+	 * @brief  Creates an instance that shares the given snapshot's value.
+	 */
+	snapshot(const snapshot<Type> &other);
+
+	/**
+	 * @brief  Creates an instance by taking over the given snapshot's value.
+	 */
+	snapshot(snapshot<Type> &&other);
+
+	/**
+	 * @brief  Lets go of the value, deleting it if nothing else holds it.
+	 */
+	~snapshot();
+
+	snapshot<Type> &operator=(const snapshot<Type> &other);
+	snapshot<Type> &operator=(snapshot<Type> &&other);
+
+	/**
+	 * @brief  Lets go of the value before the snapshot is destroyed.
+	 */
+	void reset();
+
+	/**
+	 * @brief  Returns the value, or nullptr if the snapshot is empty.
+	 */
+	Type *get() const;
+
+	Type &operator*() const;
+	Type *operator->() const;
+
+	/**
+	 * @brief  Returns whether the snapshot holds a value.
+	 */
+	explicit operator bool() const;
+
+protected:
+	template <typename, typename> friend class reader_ptr;
+	explicit snapshot(owned_detail::pin<Type> *held);
+private:
+	owned_detail::pin<Type> *pin_;
+};
+
+/**
+ * @brief  Gives each thread a reader of its own for the same owner.
+ *
+ * A thread's reader is made by copying a reader kept by this instance the
+ * first time that thread calls get(), and is reused after that. Tasks that
+ * read the owner then never pair or unpair readers. A thread's readers are
+ * deleted when it exits, or when their thread_reader is deleted, whichever is
+ * first. When the owner is deleted, the readers are invalidated as usual.
+ *
+ * This class is thread safe, but must not be deleted while another thread is
+ * using a reader it gave out. Making a thread's reader and cleaning up take a
+ * lock shared by every thread_reader of the same types.
+ */
+template <typename Type, typename Policy> class thread_reader
+{
+public:
+
+	/**
+	 * @brief  Creates an instance that gives out readers of the given owner.
+	 */
+	template <typename Deleter> explicit thread_reader(
+		owned_ptr<Type, Policy, Deleter> *owner);
+
+	/**
+	 * @brief  Deletes the readers this instance gave out to every thread.
+	 */
+	~thread_reader();
+
+	/**
+	 * @brief  Returns the calling thread's reader, making it if needed.
+	 *
+	 * The reader must only be used by the calling thread, and must not be
+	 * deleted or paired with another owner.
+	 */
+	reader_ptr<Type, Policy> &get();
+
+protected:
+
+	// A thread's reader. Listed both by its thread and by its thread_reader,
+	// and guarded by mutex_() other than the parent, which its thread reads.
+	struct slot
+	{
+		explicit slot(reader_ptr<Type, Policy> &prototype);
+		reader_ptr<Type, Policy> reader_;
+		std::atomic<thread_reader<Type, Policy>*> parent_;
+		slot *next_;
+		slot *prev_sibling_;
+		slot *next_sibling_;
+	};
+
+	// Deletes a thread's slots when the thread exits.
+	struct thread_slots
+	{
+		thread_slots();
+		~thread_slots();
+		slot *head_;
+	};
+
+	static std::mutex &mutex_();
+	static thread_slots &slots_();
+	reader_ptr<Type, Policy> &make_();
+private:
+	DISALLOW_COPY_AND_ASSIGN(thread_reader);
+	reader_ptr<Type, Policy> prototype_;
+	slot *siblings_;
+};
+
+/**
+ * @brief  Creates an owner with a value made from the given arguments.
+ * @return The new owner, moved out before any reader is given to it.
+ * @see    owned_ptr::emplace()
+ */
+template <typename Type, typename Policy = registry_policy, typename... Args>
+	owned_ptr<Type, Policy> make_owned(Args &&... args);
+
+/**
+ * @brief  Locks every given reader.
+ * @return The readers' values, in the order the readers were given.
+ * @see    reader_ptr::lock()
+ *
+ * The readers may belong to owners of different types and policies. Readers
+ * of registry_policy share a single fence, where each lock() has one of its
+ * own.
+ */
+template <typename... Types, typename... Policies> std::tuple<Types *...>
+	lock_all(reader_ptr<Types, Policies> &... readers);
+
+/**
+ * @brief  Unlocks every given reader.
+ */
+template <typename... Types, typename... Policies> void unlock_all(
+	reader_ptr<Types, Policies> &... readers);
+
+/**
+ * @brief  Locks every given reader until the returned guards are destroyed.
+ * @see    lock_all()
+ */
+template <typename... Types, typename... Policies>
+	std::tuple<read_guard<Types, Policies>...> read_all(
+	reader_ptr<Types, Policies> &... readers);
+
+#ifdef OWNED_PTR_ENABLE_STATS
+/**
+ * @brief  Returns how much all owners have waited for their readers.
+ *
+ * Only declared with OWNED_PTR_ENABLE_STATS. Like parking, the counters are
+ * kept in a static table, so a plugin linked with its own copy of this header
+ * counts on its own.
+ */
+owned_stats owned_global_stats();
+#endif
+
+/**
+ * @brief  A group of owners that are released together.
+ *
+ * Releasing owners one at a time waits for each owner's readers in turn.
+ * release() first takes the value from every owner, and only then waits, so
+ * the waits overlap and cost about as much as one owner's. Each owner is
+ * locked only while its own readers are waited on, so a reader may hold one
+ * owner's value while it gets or drops readers of another.
+ *
+ * Owners of any type and policy may be added. They must outlive the domain,
+ * or be removed from it first.
+ */
+class owned_domain
+{
+public:
+
+	/**
+	 * @brief  Creates an instance without owners.
+	 */
+	owned_domain();
+
+	/**
+	 * @brief  Releases every owner still in the domain.
+	 */
+	~owned_domain();
+
+	/**
+	 * @brief  Adds the given owner to the domain.
+	 *
+	 * @return  False, and nothing is changed, if the owner was already in
+	 *          the domain.
+	 */
+	template <typename Type, typename Policy, typename Deleter> bool add(
+		owned_ptr<Type, Policy, Deleter> &owner);
+
+	/**
+	 * @brief  Removes the given owner from the domain, if it was added.
+	 */
+	template <typename Type, typename Policy, typename Deleter> void remove(
+		owned_ptr<Type, Policy, Deleter> &owner);
+
+	/**
+	 * @brief  Invalidates the readers of every owner and deletes their values.
+	 *
+	 * Every owner is left without a value, as after its release_for(), and
+	 * the domain is left empty. The owners can be given new values with
+	 * reset().
+	 *
+	 * Snapshots are not waited for. A value that a snapshot still holds is
+	 * only deleted once its last snapshot is dropped, on that thread, so the
+	 * plugin may not be unloaded until then, as snapshot describes.
+	 */
+	void release();
+
+	/**
+	 * @brief  Returns the number of owners in the domain.
+	 */
+	size_t count();
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(owned_domain);
+	struct member
+	{
+		void *owner_;
+		void *old_;
+		void *(*invalidate_)(void *owner);
+		void (*drain_)(void *owner, void *old);
+	};
+	template <typename Owner> static void *invalidate_(void *owner);
+	template <typename Owner> static void drain_(void *owner, void *old);
+	std::mutex mutex_;
+	std::vector<member> members_;
+};
+
+/**
+ * @brief  Deletes the old values of owners once their readers let go, on a
+ *         thread of its own or with a given executor.
+ *
+ * Owners are given a reclaimer with owned_ptr::set_reclaimer(). The work of
+ * all its owners is kept in one list, and each sweep goes over all of it
+ * without waiting for any reader. Work that readers still hold up is left for
+ * the next sweep, which runs after a delay that backs off from 1 millisecond
+ * to 16 while nothing is submitted.
+ *
+ * One piece of work is either an owner's retired values or a release_async()
+ * or reset_async() call. At most the given limit is kept, and owners past it
+ * delete their values themselves, as if they had no reclaimer.
+ *
+ * This class is thread safe.
+ */
+class owned_reclaimer
+{
+public:
+
+	/**
+	 * @brief  Runs the given task after the given delay, for example on an
+	 *         event loop's timer.
+	 *
+	 * The task must not be run before the executor returns.
+	 */
+	typedef std::function<void(std::function<void()> task,
+		std::chrono::milliseconds delay)> executor;
+
+	/**
+	 * @brief  Creates an instance that sweeps on a background thread.
+	 */
+	explicit owned_reclaimer(size_t limit = OWNED_PTR_RECLAIM_LIMIT);
+
+	/**
+	 * @brief  Creates an instance that gives its sweeps to the given executor.
+	 */
+	explicit owned_reclaimer(const executor &run,
+		size_t limit = OWNED_PTR_RECLAIM_LIMIT);
+
+	/**
+	 * @brief  Waits until all work is done.
+	 *
+	 * With an executor, the executor must keep running meanwhile.
+	 */
+	~owned_reclaimer();
+
+	/**
+	 * @brief  Goes over all work once, without waiting for readers.
+	 * @return The number of pieces of work that are not done yet.
+	 *
+	 * Sweeps run on their own, but this may be called from any thread as well.
+	 */
+	size_t sweep();
+
+	/**
+	 * @brief  Returns the number of pieces of work that are not done yet.
+	 */
+	size_t count();
+
+protected:
+	template <typename, typename, typename> friend class owned_ptr;
+	bool submit_(const std::function<bool()> &poll,
+		const std::function<void()> &done);
+private:
+	DISALLOW_COPY_AND_ASSIGN(owned_reclaimer);
+	struct work
+	{
+		std::function<bool()> poll_;
+		std::function<void()> done_;
+	};
+	void run_();
+	void swept_();
+	std::mutex mutex_;
+	std::condition_variable ready_;
+	std::vector<work> work_;
+	executor executor_;
+	size_t limit_;
+	size_t count_;
+	std::chrono::milliseconds delay_;
+	bool scheduled_;
+	bool stopping_;
+	std::thread thread_;
+};
+
+/**
+ * @brief  Allocates values that are all freed together.
+ *
+ * Meant for every value of one plugin. Values are made with make() and owned
+ * by an owned_ptr with arena_delete as its deleter, which only destroys them.
+ * Once no owner or snapshot uses them anymore, for example after
+ * owned_domain::release(), release() frees all their memory at once.
+ *
+ * This class is thread safe.
+ */
+class owned_arena
+{
+public:
+
+	/**
+	 * @brief  Creates an instance without any memory.
+	 */
+	owned_arena();
+
+	/**
+	 * @brief  Frees all memory, as release() does.
+	 */
+	~owned_arena();
+
+	/**
+	 * @brief  Makes a value from the given arguments in the arena's memory.
+	 */
+	template <typename Type, typename... Args> Type *make(Args &&... args);
+
+	/**
+	 * @brief  Returns memory of the given size and alignment.
+	 */
+	void *allocate(size_t size, size_t align);
+
+	/**
+	 * @brief  Frees all memory at once, without destroying any value.
+	 *
+	 * Values still in use must not be in the arena anymore.
+	 */
+	void release();
+
+	/**
+	 * @brief  Returns the number of bytes the arena has allocated.
+	 */
+	size_t size();
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(owned_arena);
+	struct chunk
+	{
+		chunk *next_;
+		size_t size_;
+	};
+	std::mutex mutex_;
+	chunk *chunks_;
+	char *cursor_;
+	char *end_;
+	size_t size_;
+};
+
+/**
+ * @brief  A deleter for values made by owned_arena.
+ *
+ * Only runs the destructor, which does nothing for trivially destructible
+ * types. The memory is freed by owned_arena::release().
+ */
+template <typename Type> struct arena_delete
+{
+	void operator()(Type *value) const;
+};
+
+/**
+ * @brief  A small value that is stored inline and copied out by readers.
+ *
+ * For small trivially copyable types, such as an int or a plain config
+ * struct, that need no reclamation. The value is kept in the cell behind a
+ * sequence lock. A reader copies it out with plain loads and no writes, and
+ * copies again if a writer changed it meanwhile. reset() never waits for
+ * readers, and there is nothing to delete.
+ *
+ * There are no readers to invalidate. The cell must outlive every thread that
+ * uses it, so it belongs in the host rather than in a plugin.
+ *
+ * This class is thread safe.
+ */
+template <typename Type> class owned_value
+{
+public:
+
+	/**
+	 * @brief  Creates an instance with a value-initialized value.
+	 */
+	owned_value();
+
+	/**
+	 * @brief  Creates an instance with the given value.
+	 */
+	explicit owned_value(const Type &value);
+
+	/**
+	 * @brief  Returns a copy of the value.
+	 *
+	 * This method never writes to the cell, and retries only if a writer
+	 * changes the value at the same time.
+	 */
+	Type load() const;
+
+	/**
+	 * @brief  Changes the value.
+	 *
+	 * Writers are run one after another. A reader never keeps this function
+	 * waiting.
+	 */
+	void reset(const Type &value);
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(owned_value);
+	static_assert(std::is_trivially_copyable<Type>::value,
+		"owned_value needs a trivially copyable type");
+	static_assert(sizeof(Type) <= OWNED_PTR_VALUE_LIMIT,
+		"owned_value needs a type no larger than OWNED_PTR_VALUE_LIMIT");
+	enum
+	{
+		words_ = (sizeof(Type) + sizeof(std::uintptr_t) - 1) /
+			sizeof(std::uintptr_t)
+	};
+	void store_(const Type &value);
+
+	// Odd while a writer is changing the value.
+	std::atomic<size_t> sequence_;
+	std::atomic<std::uintptr_t> value_[words_];
+};
+
+/**
+ * @brief  The owner side of registry_policy.
+ *
+ * Used through owned_ptr. Every function other than attach_(), remove_() and
+ * replace_() must be called with mutex_ locked, and take_() with the other
+ * owner's mutex_ locked too.
+ *
+ * Writers are ordered by mutex_, while the list of readers is guarded by
+ * links_, the only lock a reader's thread ever takes. A reader's thread locks
+ * the reader before it locks links_, and the owner only tries to lock its
+ * readers. A writer that waits for readers sleeps without links_, and only
+ * touches readers while it holds links_, so a thread that holds a value may
+ * still pair, move or delete readers of the same owner meanwhile. The writer
+ * checks its readers under the parking lock, so nothing is woken while links_
+ * is locked.
+ */
+template <typename Type> class registry_policy::owner
+{
+protected:
+	template <typename, typename, typename> friend class ::owned_ptr;
+	friend class reader<Type>;
+	explicit owner(Type *value);
+	~owner();
+	void attach_(reader<Type> &child);
+	template <typename Iterator> void attach_many_(Iterator first,
+		Iterator last);
+	template <typename Iterator> void detach_many_(Iterator first,
+		Iterator last);
+	void remove_(reader<Type> *child);
+	void replace_(reader<Type> *child, reader<Type> *with);
+	typedef owned_detail::parking::clock::time_point time_point;
+	bool prepare_until_(const time_point &deadline);
+	Type *current_();
+	Type *publish_(Type *value);
+	bool held_(Type *value);
+	void wait_(Type *value);
+	bool wait_until_(Type *value, const time_point &deadline);
+	size_t count_();
+	size_t count_locked_();
+	owned_detail::pin_table<Type> &pins_();
+	void clear_();
+	void take_(owner<Type> &other);
+	typedef std::mutex mutex_type;
+	mutex_type mutex_;
+	std::mutex links_;
+	Type *value_;
+
+	// The list of readers, which writers and get() change, is kept apart from
+	// the table that load() locks.
+	reader<Type> *children_;
+	size_t size_;
+#if OWNED_PTR_PADDING
+	char padding_[OWNED_PTR_CACHE_LINE];
+#endif
+	owned_detail::pin_table<Type> table_;
+private:
+	DISALLOW_COPY_AND_ASSIGN(owner);
+	bool detach_(reader<Type> &child);
+	void link_(reader<Type> *child);
+	void unlink_(reader<Type> *child);
+};
+
+/**
+ * @brief  The reader side of registry_policy.
+ *
+ * Used through reader_ptr. The owner is kept in a single word, together with
+ * a bit that locks it and a bit for writers that sleep until this reader
+ * unlocks, so a reader is five words in size.
+ */
+template <typename Type> class registry_policy::reader
+{
+protected:
+	template <typename, typename> friend class ::reader_ptr;
+	friend class owner<Type>;
+	reader();
+	reader(reader<Type> &other);
+	reader(reader<Type> &&other);
+	~reader();
+	Type *lock_();
+	void stage_();
+	Type *confirm_();
+	void unlock_();
+	owned_detail::pin<Type> *pin_();
+	void set_owner_(owner<Type> *parent);
+	void assign_(reader<Type> &other);
+	std::atomic<Type*> value_;
+	std::atomic<Type*> locked_;
+
+	// Intrusive links in the owner's list of readers, guarded by the owner.
+	reader<Type> *prev_;
+	reader<Type> *next_;
+
+	// The owner, or zero, with the flags below in its lowest bits. The waiting
+	// bit is set by a writer while it waits for this reader's lock, and tells
+	// unlock_() to wake the owner's writer.
+	std::atomic<std::uintptr_t> parent_;
+	enum : std::uintptr_t
+	{
+		locked_bit_ = 1,
+		waiting_bit_ = 2
+	};
+private:
+	DISALLOW_COPY_AND_ASSIGN(reader);
+	owner<Type> *lock_parent_();
+	void unlock_parent_(owner<Type> *parent);
+};
+
+/**
+ * @brief  The owner side of sharded_policy.
+ *
+ * Used through owned_ptr. Every function other than attach_() and count_()
+ * must be called with mutex_ locked, and take_() with the other owner's mutex_
+ * locked too.
+ */
+template <std::size_t Shards> template <typename Type>
+	class sharded_policy<Shards>::owner
+{
+protected:
+	template <typename, typename, typename> friend class ::owned_ptr;
+	friend class reader<Type>;
+
+	// A counter that is kept a cache line away from any other counter. The
+	// padding is used instead of alignas, as over-aligned types cannot be
+	// allocated with new before C++17.
+	struct padded
+	{
+		std::atomic<size_t> count_;
+#if OWNED_PTR_PADDING
+		char padding_[OWNED_PTR_CACHE_LINE - sizeof(std::atomic<size_t>)];
+#endif
+	};
+
+	// Shared by the owner and its readers, and deleted by whichever of them
+	// lets go of it last. The fields that every lock() reads are kept apart
+	// from the counters that lock() and get() write.
+	struct state
+	{
+		explicit state(Type *value);
+		padded refs_;
+		std::atomic<Type*> value_;
+		std::atomic<unsigned> generation_;
+		std::atomic<bool> waiting_;
+#if OWNED_PTR_PADDING
+		char padding_[OWNED_PTR_CACHE_LINE];
+#endif
+		padded readers_[2][Shards];
+		owned_detail::pin_table<Type> table_;
+	};
+
+	explicit owner(Type *value);
+	~owner();
+	void attach_(reader<Type> &child);
+	template <typename Iterator> void attach_many_(Iterator first,
+		Iterator last);
+	template <typename Iterator> void detach_many_(Iterator first,
+		Iterator last);
+	typedef owned_detail::parking::clock::time_point time_point;
+	bool prepare_until_(const time_point &deadline);
+	Type *current_();
+	Type *publish_(Type *value);
+	bool held_(Type *value);
+	void wait_(Type *value);
+	bool wait_until_(Type *value, const time_point &deadline);
+	size_t count_();
+	size_t count_locked_();
+	owned_detail::pin_table<Type> &pins_();
+	void clear_();
+	void take_(owner<Type> &other);
+	static bool drained_(state *shared, unsigned parity);
+	static void release_(state *shared);
+	typedef std::mutex mutex_type;
+	mutex_type mutex_;
+private:
+	DISALLOW_COPY_AND_ASSIGN(owner);
+	state *state_;
+	Type *previous_;
+};
+
+/**
+ * @brief  The reader side of sharded_policy.
+ *
+ * Used through reader_ptr.
+ */
+template <std::size_t Shards> template <typename Type>
+	class sharded_policy<Shards>::reader
+{
+protected:
+	template <typename, typename> friend class ::reader_ptr;
+	friend class owner<Type>;
+	typedef typename owner<Type>::state state;
+	typedef typename owner<Type>::padded padded;
+	reader();
+	reader(reader<Type> &other);
+	reader(reader<Type> &&other);
+	~reader();
+	Type *lock_();
+	void stage_();
+	Type *confirm_();
+	void unlock_();
+	owned_detail::pin<Type> *pin_();
+	void assign_(reader<Type> &other);
+	static unsigned shard_();
+	void leave_(std::atomic<size_t> &count);
+	state *state_;
+
+	// The counter the lock is counted in, as an index into the flattened
+	// readers_ array plus one, or zero if the reader is not locked.
+	unsigned locked_;
+private:
+	DISALLOW_COPY_AND_ASSIGN(reader);
+};
+
+/**
+ * @brief  The owner side of single_thread_policy.
+ *
+ * Used through owned_ptr.
+ */
+template <typename Type> class single_thread_policy::owner
+{
+protected:
+	template <typename, typename, typename> friend class ::owned_ptr;
+	friend class reader<Type>;
+	explicit owner(Type *value);
+	~owner();
+	void attach_(reader<Type> &child);
+	template <typename Iterator> void attach_many_(Iterator first,
+		Iterator last);
+	template <typename Iterator> void detach_many_(Iterator first,
+		Iterator last);
+	typedef owned_detail::parking::clock::time_point time_point;
+	bool prepare_until_(const time_point &deadline);
+	Type *current_();
+	Type *publish_(Type *value);
+	bool held_(Type *value);
+	void wait_(Type *value);
+	bool wait_until_(Type *value, const time_point &deadline);
+	size_t count_();
+	size_t count_locked_();
+	owned_detail::pin_table<Type, owned_detail::single_sync> &pins_();
+	void clear_();
+	void take_(owner<Type> &other);
+	typedef owned_detail::null_mutex mutex_type;
+	mutex_type mutex_;
+	Type *value_;
+	reader<Type> *children_;
+	size_t size_;
+	owned_detail::pin_table<Type, owned_detail::single_sync> table_;
+private:
+	DISALLOW_COPY_AND_ASSIGN(owner);
+	void link_(reader<Type> *child);
+	void unlink_(reader<Type> *child);
+};
+
+/**
+ * @brief  The reader side of single_thread_policy.
+ *
+ * Used through reader_ptr.
+ */
+template <typename Type> class single_thread_policy::reader
+{
+protected:
+	template <typename, typename> friend class ::reader_ptr;
+	friend class owner<Type>;
+	reader();
+	reader(reader<Type> &other);
+	reader(reader<Type> &&other);
+	~reader();
+	Type *lock_();
+	void stage_();
+	Type *confirm_();
+	void unlock_();
+	owned_detail::pin<Type> *pin_();
+	void assign_(reader<Type> &other);
+	Type *locked_;
+	owner<Type> *parent_;
+
+	// Links in the owner's list of readers.
+	reader<Type> *prev_;
+	reader<Type> *next_;
+
+	// The value this reader had locked when its owner was done with it, kept
+	// until this reader lets go of it, or nullptr.
+	owned_detail::pin<Type> *kept_;
+private:
+	DISALLOW_COPY_AND_ASSIGN(reader);
+};
+
+template <typename Flag, typename Ready> void owned_detail::parking::wait(
+	const void *key, Flag &waiting, Ready ready)
+{
+	wait_until(key, waiting, ready, clock::time_point::max());
+}
+
+template <typename Flag, typename Ready>
+	bool owned_detail::parking::wait_until(const void *key, Flag &waiting,
+	Ready ready, const clock::time_point &deadline)
+{
+	if (ready())
+	{
+		return true;
+	}
+	if (deadline != clock::time_point::max() && clock::now() >= deadline)
+	{
+		return false;
+	}
+	for (unsigned i = 0; i < spin_limit_ + yield_limit_; ++i)
+	{
+		if (ready())
+		{
+			spun_(i);
+			return true;
+		}
+		if (i >= spin_limit_)
+		{
+			std::this_thread::yield();
+		}
+	}
+	spun_(spin_limit_ + yield_limit_);
+
+	// Pairs with the check in notify()'s callers. Either they see the mark, or
+	// ready() below sees that they unlocked.
+	bucket &slot = bucket_(key);
+	std::unique_lock<std::mutex> lock(slot.mutex_);
+	waiting.store(true, std::memory_order_seq_cst);
+	std::chrono::microseconds sleep(1000);
+	while (!ready())
+	{
+		clock::time_point now = clock::now();
+		if (now >= deadline)
+		{
+			waiting.store(false, std::memory_order_relaxed);
+			return false;
+		}
+		parked_();
+		slot.ready_.wait_until(lock, deadline - now < sleep ? deadline :
+			now + sleep);
+		if (sleep < std::chrono::microseconds(sleep_limit_us_))
+		{
+			sleep *= 2;
+		}
+	}
+	waiting.store(false, std::memory_order_relaxed);
+	return true;
+}
+
+inline void owned_detail::parking::notify(const void *key)
+{
+	// Taking the lock orders this wake-up after a sleeper's last check.
+	bucket &slot = bucket_(key);
+	slot.mutex_.lock();
+	slot.mutex_.unlock();
+	slot.ready_.notify_all();
+}
+
+template <typename Clock, typename Duration>
+	owned_detail::parking::clock::time_point owned_detail::parking::deadline(
+	const std::chrono::time_point<Clock, Duration> &time)
+{
+	return clock::now() +
+		std::chrono::duration_cast<clock::duration>(time - Clock::now());
+}
+
+inline owned_detail::parking::clock::time_point
+	owned_detail::parking::deadline(const clock::time_point &time)
+{
+	return time;
+}
+
+inline owned_detail::parking::bucket &owned_detail::parking::bucket_(
+	const void *key)
+{
+	// Never destroyed, as an async task may still notify after main() returns.
+	static bucket *table = new bucket[bucket_count_];
+	size_t hash = reinterpret_cast<size_t>(key);
+	return table[(hash ^ (hash >> 12)) / sizeof(void*) % bucket_count_];
+}
+
+#ifdef OWNED_PTR_ENABLE_STATS
+inline void owned_detail::parking::spun_(unsigned count)
+{
+	unsigned limit = spin_limit_;
+	stats::spun(count < limit ? count : limit,
+		count < limit ? 0 : count - limit);
+}
+
+inline void owned_detail::parking::parked_()
+{
+	stats::parked();
+}
+#else
+inline void owned_detail::parking::spun_(unsigned) {}
+
+inline void owned_detail::parking::parked_() {}
+#endif
+
+inline owned_detail::trace_span::trace_span(const char *name,
+	const void *object) : name_(name), object_(object)
+{
+	OWNED_PTR_TRACE_BEGIN(name_, object_);
+}
+
+inline owned_detail::trace_span::~trace_span()
+{
+	OWNED_PTR_TRACE_END(name_, object_);
+}
+
+inline void owned_detail::null_flag::store(bool, std::memory_order) {}
+
+inline owned_detail::word_flag::word_flag(std::atomic<std::uintptr_t> &word,
+	std::uintptr_t bit) : word_(word), bit_(bit) {}
+
+inline void owned_detail::word_flag::store(bool value, std::memory_order order)
+{
+	if (value)
+	{
+		word_.fetch_or(bit_, order);
+	}
+	else
+	{
+		word_.fetch_and(~bit_, order);
+	}
+}
+
+#ifdef OWNED_PTR_ENABLE_STATS
+inline owned_detail::stats::stats() : readers_peak_(0), wait_ns_(0),
+	wait_max_ns_(0)
+{
+	for (size_t i = 0; i < buckets_; ++i)
+	{
+		reset_waits_[i].store(0, std::memory_order_relaxed);
+		destroy_waits_[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+inline void owned_detail::stats::readers(size_t count)
+{
+	max_(readers_peak_, count);
+	if (this != &global())
+	{
+		global().readers(count);
+	}
+}
+
+inline void owned_detail::stats::wait(bool destroy,
+	parking::clock::duration time)
+{
+	std::uint64_t ns = static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+	record_(destroy, ns);
+	global().record_(destroy, ns);
+}
+
+inline void owned_detail::stats::read(owned_stats &out) const
+{
+	out.readers_peak = static_cast<size_t>(readers_peak_.load(
+		std::memory_order_relaxed));
+	for (size_t i = 0; i < buckets_; ++i)
+	{
+		out.reset_waits[i] = reset_waits_[i].load(std::memory_order_relaxed);
+		out.destroy_waits[i] = destroy_waits_[i].load(
+			std::memory_order_relaxed);
+	}
+	out.wait_ns = wait_ns_.load(std::memory_order_relaxed);
+	out.wait_max_ns = wait_max_ns_.load(std::memory_order_relaxed);
+	out.spins = 0;
+	out.yields = 0;
+	out.parks = 0;
+	out.hold_max_ns = 0;
+	out.hold_max_reader = nullptr;
+}
+
+inline owned_detail::stats &owned_detail::stats::global()
+{
+	static stats counters;
+	return counters;
+}
+
+inline void owned_detail::stats::spun(unsigned spins, unsigned yields)
+{
+	contention &counters = contention_();
+	counters.spins_.fetch_add(spins, std::memory_order_relaxed);
+	counters.yields_.fetch_add(yields, std::memory_order_relaxed);
+}
+
+inline void owned_detail::stats::parked()
+{
+	contention_().parks_.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void owned_detail::stats::held(const void *reader,
+	parking::clock::duration time)
+{
+	// Only a new longest hold takes the lock.
+	contention &counters = contention_();
+	std::uint64_t ns = static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+	if (ns <= counters.hold_max_ns_.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> guard(counters.mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	if (ns > counters.hold_max_ns_.load(std::memory_order_relaxed))
+	{
+		counters.hold_max_ns_.store(ns, std::memory_order_relaxed);
+		counters.hold_max_reader_ = reader;
+	}
+}
+
+inline void owned_detail::stats::read_global(owned_stats &out)
+{
+	global().read(out);
+	contention &counters = contention_();
+	out.spins = counters.spins_.load(std::memory_order_relaxed);
+	out.yields = counters.yields_.load(std::memory_order_relaxed);
+	out.parks = counters.parks_.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> guard(counters.mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	out.hold_max_ns = counters.hold_max_ns_.load(std::memory_order_relaxed);
+	out.hold_max_reader = counters.hold_max_reader_;
+}
+
+inline owned_detail::stats::contention &owned_detail::stats::contention_()
+{
+	// Zeroed before anything runs, as it is static.
+	static contention counters;
+	return counters;
+}
+
+inline void owned_detail::stats::max_(std::atomic<std::uint64_t> &max,
+	std::uint64_t value)
+{
+	std::uint64_t current = max.load(std::memory_order_relaxed);
+	while (value > current && !max.compare_exchange_weak(current, value,
+		std::memory_order_relaxed)) {}
+}
+
+inline void owned_detail::stats::record_(bool destroy, std::uint64_t ns)
+{
+	// Bucket i counts waits shorter than 2^i microseconds.
+	size_t bucket = 0;
+	for (std::uint64_t us = ns / 1000; us != 0 && bucket < buckets_ - 1;
+		us >>= 1)
+	{
+		++bucket;
+	}
+	(destroy ? destroy_waits_ : reset_waits_)[bucket].fetch_add(1,
+		std::memory_order_relaxed);
+	wait_ns_.fetch_add(ns, std::memory_order_relaxed);
+	max_(wait_max_ns_, ns);
+}
+#endif
+
+inline void owned_detail::null_mutex::lock() {}
+
+inline void owned_detail::null_mutex::unlock() {}
+
+inline bool owned_detail::null_mutex::try_lock()
+{
+	return true;
+}
+
+template <typename Value> owned_detail::plain_atomic<Value>::plain_atomic(
+	Value value) : value_(value) {}
+
+template <typename Value> Value owned_detail::plain_atomic<Value>::load(
+	std::memory_order) const
+{
+	return value_;
+}
+
+template <typename Value> void owned_detail::plain_atomic<Value>::store(
+	Value value, std::memory_order)
+{
+	value_ = value;
+}
+
+template <typename Type, typename Sync>
+	owned_detail::pin_table<Type, Sync>::pin_table(Type *value) :
+	value_(value), pins_(nullptr) {}
+
+template <typename Type, typename Sync> owned_detail::pin<Type>
+	*owned_detail::pin_table<Type, Sync>::acquire()
+{
+	std::lock_guard<typename Sync::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	for (;;)
+	{
+		Type *value = value_.load(std::memory_order_seq_cst);
+		if (value == nullptr)
+		{
+			return nullptr;
+		}
+
+		pin<Type> *head = pins_.load(std::memory_order_relaxed);
+		for (pin<Type> *held = head; held != nullptr; held = held->next_)
+		{
+			if (held->value_ == value)
+			{
+				held->refs_.fetch_add(1, std::memory_order_relaxed);
+				return held;
+			}
+		}
+		pin<Type> *held = new pin<Type>;
+		held->refs_.store(2, std::memory_order_relaxed);
+		held->value_ = value;
+		held->next_ = head;
+		held->destroy_ = &destroy_;
+
+		// Pairs with publish() and dispose(). Either the writer finds this pin
+		// once it is done with the value, or the check below sees the value
+		// replaced and the pin is dropped before it is used.
+		pins_.store(held, std::memory_order_seq_cst);
+		if (value_.load(std::memory_order_seq_cst) == value)
+		{
+			return held;
+		}
+		pins_.store(head, std::memory_order_relaxed);
+		delete held;
+	}
+}
+
+template <typename Type, typename Sync> owned_detail::pin<Type>
+	*owned_detail::pin_table<Type, Sync>::keep(Type *value)
+{
+	// As acquire(), but for a value that is no longer published, and that the
+	// owner disposes of next, which gives the pin its deleter.
+	std::lock_guard<typename Sync::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	pin<Type> *head = pins_.load(std::memory_order_relaxed);
+	for (pin<Type> *held = head; held != nullptr; held = held->next_)
+	{
+		if (held->value_ == value)
+		{
+			held->refs_.fetch_add(1, std::memory_order_relaxed);
+			return held;
+		}
+	}
+	pin<Type> *held = new pin<Type>;
+	held->refs_.store(2, std::memory_order_relaxed);
+	held->value_ = value;
+	held->next_ = head;
+	held->destroy_ = &destroy_;
+	pins_.store(held, std::memory_order_seq_cst);
+	return held;
+}
+
+template <typename Type, typename Sync>
+	void owned_detail::pin_table<Type, Sync>::publish(Type *value)
+{
+	value_.store(value, std::memory_order_seq_cst);
+}
+
+template <typename Type, typename Sync> template <typename Deleter>
+	void owned_detail::pin_table<Type, Sync>::dispose(Type *value,
+	Deleter &deleter)
+{
+	if (value == nullptr)
+	{
+		return;
+	}
+	pin<Type> *held = nullptr;
+	if (pins_.load(std::memory_order_seq_cst) != nullptr)
+	{
+		std::lock_guard<typename Sync::mutex> guard(mutex_);
+		(void)guard; // Remove 'unused' warnings.
+		// The last pin may have been taken by another value's dispose() since
+		// the check above.
+		pin<Type> *head = pins_.load(std::memory_order_relaxed);
+		if (head != nullptr && head->value_ == value)
+		{
+			held = head;
+			pins_.store(head->next_, std::memory_order_relaxed);
+		}
+		else if (head != nullptr)
+		{
+			for (pin<Type> *prev = head; prev->next_ != nullptr;
+				prev = prev->next_)
+			{
+				if (prev->next_->value_ == value)
+				{
+					held = prev->next_;
+					prev->next_ = held->next_;
+					break;
+				}
+			}
+		}
+	}
+	if (held != nullptr)
+	{
+		// A value made by make() is destroyed with its block instead. The size
+		// of the deleter is checked by owned_ptr.
+		if (held->destroy_ == &destroy_)
+		{
+			new (held->deleter_) Deleter(deleter);
+			held->destroy_ = &destroy_with_<Deleter>;
+		}
+		release(held);
+		return;
+	}
+	deleter(value);
+}
+
+template <typename Type, typename Sync>
+	void owned_detail::pin_table<Type, Sync>::adopt(pin<Type> *held)
+{
+	// Called before the value is published, so acquire() finds this pin and
+	// never makes a second one for the same value.
+	std::lock_guard<typename Sync::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	held->next_ = pins_.load(std::memory_order_relaxed);
+	pins_.store(held, std::memory_order_seq_cst);
+}
+
+template <typename Type, typename Sync>
+	void owned_detail::pin_table<Type, Sync>::take(pin_table<Type, Sync> &other)
+{
+	std::lock_guard<typename Sync::mutex> guard(mutex_);
+	std::lock_guard<typename Sync::mutex> other_guard(other.mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	(void)other_guard;
+	value_.store(other.value_.load(std::memory_order_relaxed),
+		std::memory_order_seq_cst);
+	pins_.store(other.pins_.load(std::memory_order_relaxed),
+		std::memory_order_relaxed);
+	other.value_.store(nullptr, std::memory_order_seq_cst);
+	other.pins_.store(nullptr, std::memory_order_relaxed);
+}
+
+template <typename Type, typename Sync> template <typename... Args>
+	owned_detail::pin<Type> *owned_detail::pin_table<Type, Sync>::make(
+	Args &&... args)
+{
+	std::unique_ptr<pin_block<Type>> block(new pin_block<Type>);
+	Type *value = new (&block->storage_) Type(std::forward<Args>(args)...);
+	pin<Type> *held = &block.release()->pin_;
+	held->refs_.store(1, std::memory_order_relaxed);
+	held->value_ = value;
+	held->next_ = nullptr;
+	held->destroy_ = &destroy_block_;
+	return held;
+}
+
+template <typename Type, typename Sync>
+	void owned_detail::pin_table<Type, Sync>::release(pin<Type> *held)
+{
+	if (held->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		held->destroy_(held);
+	}
+}
+
+template <typename Type, typename Sync>
+	void owned_detail::pin_table<Type, Sync>::destroy_(pin<Type> *held)
+{
+	delete held->value_;
+	delete held;
+}
+
+template <typename Type, typename Sync>
+	void owned_detail::pin_table<Type, Sync>::destroy_block_(pin<Type> *held)
+{
+	// The pin is the block's first member.
+	held->value_->~Type();
+	delete reinterpret_cast<pin_block<Type> *>(held);
+}
+
+template <typename Type, typename Sync> template <typename Deleter>
+	void owned_detail::pin_table<Type, Sync>::destroy_with_(pin<Type> *held)
+{
+	Deleter *deleter = reinterpret_cast<Deleter *>(held->deleter_);
+	(*deleter)(held->value_);
+	deleter->~Deleter();
+	delete held;
+}
+
+template <typename Deleter, bool Empty>
+	owned_detail::deleter_base<Deleter, Empty>::deleter_base(
+	const Deleter &deleter) : Deleter(deleter) {}
+
+template <typename Deleter, bool Empty>
+	Deleter &owned_detail::deleter_base<Deleter, Empty>::deleter()
+{
+	return *this;
+}
+
+template <typename Deleter, bool Empty> const Deleter
+	&owned_detail::deleter_base<Deleter, Empty>::deleter() const
+{
+	return *this;
+}
+
+template <typename Deleter>
+	owned_detail::deleter_base<Deleter, false>::deleter_base(
+	const Deleter &deleter) : deleter_(deleter) {}
+
+template <typename Deleter>
+	Deleter &owned_detail::deleter_base<Deleter, false>::deleter()
+{
+	return deleter_;
+}
+
+template <typename Deleter> const Deleter
+	&owned_detail::deleter_base<Deleter, false>::deleter() const
+{
+	return deleter_;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	owned_ptr<Type, Policy, Deleter>::owned_ptr() :
+	owned_detail::deleter_base<Deleter>(Deleter()), core_(nullptr),
+	retired_count_(0), mode_(reclaim_mode::blocking), async_(0),
+	reclaimer_(nullptr), queued_(false) {}
+
+template <typename Type, typename Policy, typename Deleter>
+	owned_ptr<Type, Policy, Deleter>::owned_ptr(Type *value, reclaim_mode mode,
+	const Deleter &deleter) : owned_detail::deleter_base<Deleter>(deleter),
+	core_(value), retired_count_(0), mode_(mode), async_(0),
+	reclaimer_(nullptr), queued_(false) {}
+
+template <typename Type, typename Policy, typename Deleter>
+	owned_ptr<Type, Policy, Deleter>::owned_ptr(
+	owned_ptr<Type, Policy, Deleter> &&other) :
+	owned_detail::deleter_base<Deleter>(other.get_deleter()), core_(nullptr),
+	retired_count_(0), mode_(other.mode_), async_(0),
+	reclaimer_(other.reclaimer_), queued_(false)
+{
+	take_(other);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	owned_ptr<Type, Policy, Deleter>::~owned_ptr()
+{
+	wait_async_();
+	drain_(invalidate_());
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	owned_ptr<Type, Policy, Deleter> &owned_ptr<Type, Policy, Deleter>::operator=(
+	owned_ptr<Type, Policy, Deleter> &&other)
+{
+	if (this != &other)
+	{
+		wait_async_();
+		drain_(invalidate_());
+		get_deleter() = other.get_deleter();
+		mode_ = other.mode_;
+		reclaimer_ = other.reclaimer_;
+		take_(other);
+	}
+	return *this;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::get(reader_ptr<Type, Policy> &reader)
+{
+	core_.attach_(reader.core_);
+#ifdef OWNED_PTR_ENABLE_STATS
+	stats_.readers(core_.count_());
+#endif
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Iterator>
+	void owned_ptr<Type, Policy, Deleter>::get_many(Iterator first,
+	Iterator last)
+{
+	core_.attach_many_(first, last);
+#ifdef OWNED_PTR_ENABLE_STATS
+	stats_.readers(core_.count_());
+#endif
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Iterator>
+	void owned_ptr<Type, Policy, Deleter>::detach_many(Iterator first,
+	Iterator last)
+{
+	core_.detach_many_(first, last);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::reset(Type *value)
+{
+	owned_detail::trace_span span("owned_ptr::reset", this);
+	core_.mutex_.lock();
+	Type *old = core_.publish_(value);
+	if (mode_ == reclaim_mode::deferred)
+	{
+		old = retire_(old);
+		core_.mutex_.unlock();
+		dispose_(old);
+		return;
+	}
+	wait_(old, false);
+	dispose_(old);
+
+	// Values retired by the timed functions are deleted here too, unless the
+	// reclaimer has them, as in retire_().
+	if (!queued_)
+	{
+		collect_();
+	}
+	core_.mutex_.unlock();
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename... Args>
+	void owned_ptr<Type, Policy, Deleter>::emplace(Args &&... args)
+{
+	owned_detail::pin<Type> *held = owned_detail::pin_table<Type>::make(
+		std::forward<Args>(args)...);
+	core_.pins_().adopt(held);
+	reset(held->value_);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Function>
+	bool owned_ptr<Type, Policy, Deleter>::update(Function function)
+{
+	std::unique_lock<mutex_type> guard(core_.mutex_);
+	Type *current = core_.current_();
+	if (current == nullptr)
+	{
+		return false;
+	}
+
+	// The copy is made in a block of its own, so it is never given to Deleter.
+	owned_detail::pin<Type> *held = owned_detail::pin_table<Type>::make(
+		*current);
+	try
+	{
+		function(*held->value_);
+	}
+	catch (...)
+	{
+		owned_detail::pin_table<Type>::release(held);
+		throw;
+	}
+	core_.pins_().adopt(held);
+	Type *old = retire_(core_.publish_(held->value_));
+	guard.unlock();
+	dispose_(old);
+	return true;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	reset_status owned_ptr<Type, Policy, Deleter>::try_reset(Type *value)
+{
+	return reset_until_(value, owned_detail::parking::clock::now());
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Rep, typename Period>
+	reset_status owned_ptr<Type, Policy, Deleter>::reset_for(Type *value,
+	const std::chrono::duration<Rep, Period> &timeout)
+{
+	return reset_until_(value, owned_detail::parking::clock::now() +
+		std::chrono::duration_cast<owned_detail::parking::clock::duration>(
+		timeout));
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Clock, typename Duration>
+	reset_status owned_ptr<Type, Policy, Deleter>::reset_until(Type *value,
+	const std::chrono::time_point<Clock, Duration> &deadline)
+{
+	return reset_until_(value, owned_detail::parking::deadline(deadline));
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Rep, typename Period>
+	reset_status owned_ptr<Type, Policy, Deleter>::release_for(
+	const std::chrono::duration<Rep, Period> &timeout)
+{
+	return release_until_(owned_detail::parking::clock::now() +
+		std::chrono::duration_cast<owned_detail::parking::clock::duration>(
+		timeout));
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Clock, typename Duration>
+	reset_status owned_ptr<Type, Policy, Deleter>::release_until(
+	const std::chrono::time_point<Clock, Duration> &deadline)
+{
+	return release_until_(owned_detail::parking::deadline(deadline));
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	std::future<void> owned_ptr<Type, Policy, Deleter>::release_async()
+{
+	std::shared_ptr<std::promise<void>> done =
+		std::make_shared<std::promise<void>>();
+	std::future<void> result = done->get_future();
+	release_async([done]() { done->set_value(); });
+	return result;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Function>
+	void owned_ptr<Type, Policy, Deleter>::release_async(Function done)
+{
+	Type *old = invalidate_();
+	if (collect_() == 0 && (old == nullptr || !core_.held_(old)))
+	{
+		// Nothing is left to wait for.
+		drain_(old);
+		done();
+		return;
+	}
+	core_.mutex_.unlock();
+	run_async_([this, old]()
+	{
+		if (!core_.mutex_.try_lock())
+		{
+			return false;
+		}
+		if (collect_() != 0 || (old != nullptr && core_.held_(old)))
+		{
+			core_.mutex_.unlock();
+			return false;
+		}
+		core_.mutex_.unlock();
+		dispose_(old);
+		return true;
+	}, done);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	std::future<void> owned_ptr<Type, Policy, Deleter>::reset_async(
+	Type *value)
+{
+	std::shared_ptr<std::promise<void>> done =
+		std::make_shared<std::promise<void>>();
+	std::future<void> result = done->get_future();
+	reset_async(value, [done]() { done->set_value(); });
+	return result;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Function>
+	void owned_ptr<Type, Policy, Deleter>::reset_async(Type *value,
+	Function done)
+{
+	owned_detail::trace_span span("owned_ptr::reset", this);
+	core_.mutex_.lock();
+	Type *old = core_.publish_(value);
+	if (old == nullptr || !core_.held_(old))
+	{
+		core_.mutex_.unlock();
+		dispose_(old);
+		done();
+		return;
+	}
+	core_.mutex_.unlock();
+	run_async_([this, old]()
+	{
+		if (!core_.mutex_.try_lock())
+		{
+			return false;
+		}
+		bool held = core_.held_(old);
+		core_.mutex_.unlock();
+		if (!held)
+		{
+			dispose_(old);
+		}
+		return !held;
+	}, done);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::set_reclaimer(
+	owned_reclaimer *reclaimer)
+{
+	// The reclaimer polls from its own thread, as run_async_() does. This is
+	// the only way to set one, so reclaim_() is never reached with this policy.
+	static_assert(!std::is_same<Policy, single_thread_policy>::value,
+		"single_thread_policy has no reclaimer");
+	reclaimer_ = reclaimer;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	size_t owned_ptr<Type, Policy, Deleter>::collect()
+{
+	std::lock_guard<mutex_type> guard(core_.mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	return collect_();
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	size_t owned_ptr<Type, Policy, Deleter>::count()
+{
+	return core_.count_();
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	Type *owned_ptr<Type, Policy, Deleter>::invalidate_()
+{
+	// Left locked for drain_(), so that nothing is published in between.
+	core_.mutex_.lock();
+	return core_.publish_(nullptr);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::drain_(Type *old)
+{
+	owned_detail::trace_span span("owned_ptr::drain", this);
+	wait_(old, true);
+	for (size_t i = 0; i < retired_count_; ++i)
+	{
+		wait_(retired_[i], true);
+		dispose_(retired_[i]);
+	}
+	retired_count_ = 0;
+	core_.mutex_.unlock();
+	dispose_(old);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	Type *owned_ptr<Type, Policy, Deleter>::withdraw_()
+{
+	// As invalidate_(), but unlocked again, for owned_domain::release().
+	std::lock_guard<mutex_type> guard(core_.mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	return core_.publish_(nullptr);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::redrain_(Type *old)
+{
+	core_.mutex_.lock();
+	drain_(old);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::dispose_(Type *value)
+{
+	core_.pins_().dispose(value, get_deleter());
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	size_t owned_ptr<Type, Policy, Deleter>::count_locked()
+{
+	return core_.count_locked_();
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	reclaim_mode owned_ptr<Type, Policy, Deleter>::mode() const
+{
+	return mode_;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	Deleter &owned_ptr<Type, Policy, Deleter>::get_deleter()
+{
+	return this->deleter();
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	const Deleter &owned_ptr<Type, Policy, Deleter>::get_deleter() const
+{
+	return this->deleter();
+}
+
+#ifdef OWNED_PTR_ENABLE_STATS
+template <typename Type, typename Policy, typename Deleter>
+	owned_stats owned_ptr<Type, Policy, Deleter>::stats() const
+{
+	owned_stats out;
+	stats_.read(out);
+	return out;
+}
+#endif
+
+template <typename Type, typename Policy, typename Deleter>
+	bool owned_ptr<Type, Policy, Deleter>::reserve_until_(
+	const time_point &deadline)
+{
+	// Makes room to retire the current value, and lets the policy get ready to
+	// publish a new one.
+	while (collect_() == OWNED_PTR_RETIRE_LIMIT)
+	{
+		if (!wait_until_(retired_[0], deadline, false))
+		{
+			if (collect_() == OWNED_PTR_RETIRE_LIMIT)
+			{
+				return false;
+			}
+			break;
+		}
+	}
+	return core_.prepare_until_(deadline);
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	reset_status owned_ptr<Type, Policy, Deleter>::reset_until_(Type *value,
+	const time_point &deadline)
+{
+	owned_detail::trace_span span("owned_ptr::reset", this);
+	core_.mutex_.lock();
+	if (!reserve_until_(deadline))
+	{
+		core_.mutex_.unlock();
+		return reset_status::busy;
+	}
+	// Publishing no value is counted as release_until() is.
+	Type *old = core_.publish_(value);
+	if (!wait_until_(old, deadline, value == nullptr))
+	{
+		retired_[retired_count_++] = old;
+		core_.mutex_.unlock();
+		return reset_status::retired;
+	}
+	core_.mutex_.unlock();
+	dispose_(old);
+	return reset_status::done;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	reset_status owned_ptr<Type, Policy, Deleter>::release_until_(
+	const time_point &deadline)
+{
+	owned_detail::trace_span span("owned_ptr::release", this);
+	reset_status status = reset_until_(nullptr, deadline);
+	if (status == reset_status::busy)
+	{
+		return status;
+	}
+
+	std::lock_guard<mutex_type> guard(core_.mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	for (size_t i = 0; i < retired_count_; ++i)
+	{
+		if (!wait_until_(retired_[i], deadline, true))
+		{
+			break;
+		}
+	}
+	return collect_() == 0 ? reset_status::done : reset_status::retired;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::take_(
+	owned_ptr<Type, Policy, Deleter> &other)
+{
+	// This owner has no values left, but may still have readers. The other
+	// owner's tasks wait on its readers, so they must be done first.
+	other.wait_async_();
+	core_.mutex_.lock();
+	core_.clear_();
+	other.core_.mutex_.lock();
+	core_.take_(other.core_);
+	for (size_t i = 0; i < other.retired_count_; ++i)
+	{
+		retired_[i] = other.retired_[i];
+	}
+	retired_count_ = other.retired_count_;
+	other.retired_count_ = 0;
+	other.core_.mutex_.unlock();
+	core_.mutex_.unlock();
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::wait_(Type *value, bool destroy)
+{
+#ifdef OWNED_PTR_ENABLE_STATS
+	time_point start = owned_detail::parking::clock::now();
+	core_.wait_(value);
+	if (value != nullptr)
+	{
+		stats_.wait(destroy, owned_detail::parking::clock::now() - start);
+	}
+#else
+	(void)destroy; // Remove 'unused' warnings.
+	core_.wait_(value);
+#endif
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	bool owned_ptr<Type, Policy, Deleter>::wait_until_(Type *value,
+	const time_point &deadline, bool destroy)
+{
+#ifdef OWNED_PTR_ENABLE_STATS
+	time_point start = owned_detail::parking::clock::now();
+	bool unlocked = core_.wait_until_(value, deadline);
+	if (value != nullptr)
+	{
+		stats_.wait(destroy, owned_detail::parking::clock::now() - start);
+	}
+	return unlocked;
+#else
+	(void)destroy; // Remove 'unused' warnings.
+	return core_.wait_until_(value, deadline);
+#endif
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	template <typename Poll, typename Function>
+	void owned_ptr<Type, Policy, Deleter>::run_async_(Poll poll, Function done)
+{
+	// Its readers could only be unlocked by this thread, and the poll would
+	// touch its state from another.
+	static_assert(!std::is_same<Policy, single_thread_policy>::value,
+		"single_thread_policy has no async reset or release");
+
+	// Counted before the task starts, so the destructor waits for it. Once the
+	// count drops, the owner may be gone, so done() only uses copies.
+	async_.fetch_add(async_task_, std::memory_order_relaxed);
+	std::atomic<std::uintptr_t> *count = &async_;
+	auto finish = [done, count]()
+	{
+		finish_async_(count);
+		done();
+	};
+
+	// A reclaimer polls the work, where a thread of its own polls it until it
+	// is done. Either way the owner is only locked for each poll, never while
+	// readers are waited on, so it stays free for reset() and get().
+	if (reclaimer_ != nullptr && reclaimer_->submit_(poll, finish))
+	{
+		return;
+	}
+	auto task = [poll, finish]()
+	{
+		std::chrono::milliseconds delay(1);
+		while (!poll())
+		{
+			std::this_thread::sleep_for(delay);
+			if (delay < std::chrono::milliseconds(16))
+			{
+				delay *= 2;
+			}
+		}
+		finish();
+	};
+	try
+	{
+		std::thread(task).detach();
+	}
+	catch (const std::system_error &)
+	{
+		// Without a thread, the caller waits instead.
+		task();
+	}
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::finish_async_(
+	std::atomic<std::uintptr_t> *count)
+{
+	// Only the address is used once the count drops.
+	if (count->fetch_sub(async_task_, std::memory_order_acq_rel) &
+		async_waiting_)
+	{
+		owned_detail::parking::notify(count);
+	}
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_ptr<Type, Policy, Deleter>::wait_async_()
+{
+	if (reclaimer_ != nullptr)
+	{
+		// This may be the reclaimer's own sweep, destroying the owner from a
+		// callback, so the reclaimer is swept here as well.
+		for (;;)
+		{
+			reclaimer_->sweep();
+			if (async_.load(std::memory_order_acquire) < async_task_)
+			{
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	owned_detail::word_flag waiting(async_, async_waiting_);
+	std::atomic<std::uintptr_t> *count = &async_;
+	owned_detail::parking::wait(count, waiting, [count]()
+	{
+		return count->load(std::memory_order_acquire) < async_task_;
+	});
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	bool owned_ptr<Type, Policy, Deleter>::reclaim_()
+{
+	// Called locked. The retired values are queued once, and stay queued until
+	// the reclaimer has deleted them all.
+	if (queued_)
+	{
+		return true;
+	}
+	async_.fetch_add(async_task_, std::memory_order_relaxed);
+	std::atomic<std::uintptr_t> *count = &async_;
+	if (!reclaimer_->submit_([this]() { return collect_async_(); },
+		[count]() { finish_async_(count); }))
+	{
+		async_.fetch_sub(async_task_, std::memory_order_relaxed);
+		return false;
+	}
+	queued_ = true;
+	return true;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	bool owned_ptr<Type, Policy, Deleter>::collect_async_()
+{
+	if (!core_.mutex_.try_lock())
+	{
+		return false;
+	}
+	bool done = collect_() == 0;
+	if (done)
+	{
+		queued_ = false;
+	}
+	core_.mutex_.unlock();
+	return done;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	Type *owned_ptr<Type, Policy, Deleter>::retire_(Type *old)
+{
+	// Returns the old value to be disposed of if no reader holds it anymore.
+	// With a reclaimer, every old value is retired to be deleted by it, and
+	// retired values are never deleted here.
+	if (old != nullptr && reclaimer_ != nullptr && reclaim_())
+	{
+		if (retired_count_ == OWNED_PTR_RETIRE_LIMIT)
+		{
+			wait_(old, false);
+			return old;
+		}
+		retired_[retired_count_++] = old;
+		return nullptr;
+	}
+	if (old != nullptr && core_.held_(old))
+	{
+		while (collect_() == OWNED_PTR_RETIRE_LIMIT)
+		{
+			wait_(retired_[0], false);
+		}
+		retired_[retired_count_++] = old;
+		return nullptr;
+	}
+	if (!queued_)
+	{
+		collect_();
+	}
+	return old;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	size_t owned_ptr<Type, Policy, Deleter>::collect_()
+{
+	size_t i = 0;
+	while (i < retired_count_)
+	{
+		if (core_.held_(retired_[i]))
+		{
+			++i;
+		}
+		else
+		{
+			dispose_(retired_[i]);
+			retired_[i] = retired_[--retired_count_];
+		}
+	}
+	return retired_count_;
+}
+
+template <typename Type, typename Policy> reader_ptr<Type, Policy>::reader_ptr()
+	{}
+
+template <typename Type, typename Policy> template <typename Deleter>
+	reader_ptr<Type, Policy>::reader_ptr(
+	owned_ptr<Type, Policy, Deleter> *owner)
+{
+	owner->get(*this);
+}
+
+template <typename Type, typename Policy> reader_ptr<Type, Policy>::reader_ptr(
+	reader_ptr<Type, Policy> &other) : core_(other.core_) {}
+
+template <typename Type, typename Policy> reader_ptr<Type, Policy>::reader_ptr(
+	reader_ptr<Type, Policy> &&other) : core_(std::move(other.core_))
+{
+#ifdef OWNED_PTR_ENABLE_STATS
+	locked_at_ = other.locked_at_;
+	other.locked_at_ = owned_detail::parking::clock::time_point();
+#endif
+}
+
+template <typename Type, typename Policy> reader_ptr<Type, Policy>
+	&reader_ptr<Type, Policy>::operator=(reader_ptr<Type, Policy> &&other)
+{
+	if (this != &other)
+	{
+#ifdef OWNED_PTR_ENABLE_STATS
+		held_();
+		locked_at_ = other.locked_at_;
+		other.locked_at_ = owned_detail::parking::clock::time_point();
+#endif
+		core_.assign_(other.core_);
+	}
+	return *this;
+}
+
+template <typename Type, typename Policy> Type *reader_ptr<Type, Policy>::lock()
+{
+#ifdef OWNED_PTR_ENABLE_STATS
+	// A lock() while locked keeps timing from the first.
+	Type *value = core_.lock_();
+	if (value != nullptr &&
+		locked_at_ == owned_detail::parking::clock::time_point())
+	{
+		locked_at_ = owned_detail::parking::clock::now();
+	}
+	return value;
+#else
+	return core_.lock_();
+#endif
+}
+
+template <typename Type, typename Policy>
+	void reader_ptr<Type, Policy>::stage_()
+{
+	core_.stage_();
+}
+
+template <typename Type, typename Policy>
+	Type *reader_ptr<Type, Policy>::confirm_()
+{
+	Type *value = core_.confirm_();
+#ifdef OWNED_PTR_ENABLE_STATS
+	if (value != nullptr &&
+		locked_at_ == owned_detail::parking::clock::time_point())
+	{
+		locked_at_ = owned_detail::parking::clock::now();
+	}
+#endif
+	return value;
+}
+
+template <typename Type, typename Policy> void reader_ptr<Type, Policy>::unlock()
+{
+	core_.unlock_();
+#ifdef OWNED_PTR_ENABLE_STATS
+	held_();
+#endif
+}
+
+template <typename Type, typename Policy> read_guard<Type, Policy>
+	reader_ptr<Type, Policy>::read()
+{
+	return read_guard<Type, Policy>(*this);
+}
+
+template <typename Type, typename Policy> snapshot<Type>
+	reader_ptr<Type, Policy>::load()
+{
+	return snapshot<Type>(core_.pin_());
+}
+
+template <typename Type, typename Policy> bool reader_ptr<Type, Policy>::copy(
+	Type &out)
+{
+	// The guard unlocks even if the copy throws.
+	read_guard<Type, Policy> guard(*this);
+	if (!guard)
+	{
+		return false;
+	}
+	out = *guard;
+	return true;
+}
+
+#ifdef OWNED_PTR_ENABLE_STATS
+template <typename Type, typename Policy> void reader_ptr<Type, Policy>::held_()
+{
+	if (locked_at_ != owned_detail::parking::clock::time_point())
+	{
+		owned_detail::stats::held(this,
+			owned_detail::parking::clock::now() - locked_at_);
+		locked_at_ = owned_detail::parking::clock::time_point();
+	}
+}
+#endif
+
+template <typename Type, typename Policy> read_guard<Type, Policy>::read_guard()
+	: reader_(nullptr), value_(nullptr) {}
+
+template <typename Type, typename Policy> read_guard<Type, Policy>::read_guard(
+	reader_ptr<Type, Policy> &reader) : reader_(&reader), value_(reader.lock())
+{
+#ifdef OWNED_PTR_TRACE_READS
+	if (value_ != nullptr)
+	{
+		OWNED_PTR_TRACE_BEGIN("read_guard", reader_);
+	}
+#endif
+}
+
+template <typename Type, typename Policy> read_guard<Type, Policy>::read_guard(
+	read_guard<Type, Policy> &&other) : reader_(other.reader_),
+	value_(other.value_)
+{
+	other.reader_ = nullptr;
+	other.value_ = nullptr;
+}
+
+template <typename Type, typename Policy> read_guard<Type, Policy>::~read_guard()
+{
+	unlock();
+}
+
+template <typename Type, typename Policy> read_guard<Type, Policy>
+	&read_guard<Type, Policy>::operator=(read_guard<Type, Policy> &&other)
+{
+	if (this != &other)
+	{
+		unlock();
+		reader_ = other.reader_;
+		value_ = other.value_;
+		other.reader_ = nullptr;
+		other.value_ = nullptr;
+	}
+	return *this;
+}
+
+template <typename Type, typename Policy> void read_guard<Type, Policy>::unlock()
+{
+	if (reader_ != nullptr)
+	{
+#ifdef OWNED_PTR_TRACE_READS
+		if (value_ != nullptr)
+		{
+			OWNED_PTR_TRACE_END("read_guard", reader_);
+		}
+#endif
+		reader_->unlock();
+		reader_ = nullptr;
+		value_ = nullptr;
+	}
+}
+
+template <typename Type, typename Policy> Type *read_guard<Type, Policy>::get()
+	const
+{
+	return value_;
+}
+
+template <typename Type, typename Policy> Type
+	&read_guard<Type, Policy>::operator*() const
+{
+	return *value_;
+}
+
+template <typename Type, typename Policy> Type
+	*read_guard<Type, Policy>::operator->() const
+{
+	return value_;
+}
+
+template <typename Type, typename Policy> read_guard<Type, Policy>::operator
+	bool() const
+{
+	return value_ != nullptr;
+}
+
+template <typename Type> snapshot<Type>::snapshot() : pin_(nullptr) {}
+
+template <typename Type> snapshot<Type>::snapshot(
+	owned_detail::pin<Type> *held) : pin_(held) {}
+
+template <typename Type> snapshot<Type>::snapshot(const snapshot<Type> &other)
+	: pin_(other.pin_)
+{
+	if (pin_ != nullptr)
+	{
+		pin_->refs_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+template <typename Type> snapshot<Type>::snapshot(snapshot<Type> &&other) :
+	pin_(other.pin_)
+{
+	other.pin_ = nullptr;
+}
+
+template <typename Type> snapshot<Type>::~snapshot()
+{
+	reset();
+}
+
+template <typename Type> snapshot<Type> &snapshot<Type>::operator=(
+	const snapshot<Type> &other)
+{
+	if (other.pin_ != nullptr)
+	{
+		other.pin_->refs_.fetch_add(1, std::memory_order_relaxed);
+	}
+	reset();
+	pin_ = other.pin_;
+	return *this;
+}
+
+template <typename Type> snapshot<Type> &snapshot<Type>::operator=(
+	snapshot<Type> &&other)
+{
+	if (this != &other)
+	{
+		reset();
+		pin_ = other.pin_;
+		other.pin_ = nullptr;
+	}
+	return *this;
+}
+
+template <typename Type> void snapshot<Type>::reset()
+{
+	if (pin_ != nullptr)
+	{
+		owned_detail::pin_table<Type>::release(pin_);
+		pin_ = nullptr;
+	}
+}
+
+template <typename Type> Type *snapshot<Type>::get() const
+{
+	return pin_ == nullptr ? nullptr : pin_->value_;
+}
+
+template <typename Type> Type &snapshot<Type>::operator*() const
+{
+	return *pin_->value_;
+}
+
+template <typename Type> Type *snapshot<Type>::operator->() const
+{
+	return pin_->value_;
+}
+
+template <typename Type> snapshot<Type>::operator bool() const
+{
+	return pin_ != nullptr;
+}
+
+template <typename Type, typename Policy> template <typename Deleter>
+	thread_reader<Type, Policy>::thread_reader(
+	owned_ptr<Type, Policy, Deleter> *owner) : prototype_(owner),
+	siblings_(nullptr) {}
+
+template <typename Type, typename Policy>
+	thread_reader<Type, Policy>::~thread_reader()
+{
+	// The slots are left to their threads, but their readers let go of the
+	// owner now, as it may be deleted next.
+	std::lock_guard<std::mutex> guard(mutex_());
+	(void)guard; // Remove 'unused' warnings.
+	for (slot *it = siblings_; it != nullptr; it = it->next_sibling_)
+	{
+		it->reader_ = reader_ptr<Type, Policy>();
+		it->parent_.store(nullptr, std::memory_order_release);
+	}
+}
+
+template <typename Type, typename Policy>
+	reader_ptr<Type, Policy> &thread_reader<Type, Policy>::get()
+{
+	for (slot *it = slots_().head_; it != nullptr; it = it->next_)
+	{
+		if (it->parent_.load(std::memory_order_acquire) == this)
+		{
+			return it->reader_;
+		}
+	}
+	return make_();
+}
+
+template <typename Type, typename Policy>
+	reader_ptr<Type, Policy> &thread_reader<Type, Policy>::make_()
+{
+	std::lock_guard<std::mutex> guard(mutex_());
+	(void)guard; // Remove 'unused' warnings.
+	thread_slots &slots = slots_();
+
+	// Slots left behind by deleted thread_readers are freed here, so that
+	// long-lived threads do not collect them.
+	slot **link = &slots.head_;
+	while (*link != nullptr)
+	{
+		slot *it = *link;
+		if (it->parent_.load(std::memory_order_relaxed) == nullptr)
+		{
+			*link = it->next_;
+			delete it;
+		}
+		else
+		{
+			link = &it->next_;
+		}
+	}
+
+	slot *made = new slot(prototype_);
+	made->parent_.store(this, std::memory_order_relaxed);
+	made->next_ = slots.head_;
+	slots.head_ = made;
+	made->next_sibling_ = siblings_;
+	if (siblings_ != nullptr)
+	{
+		siblings_->prev_sibling_ = made;
+	}
+	siblings_ = made;
+	return made->reader_;
+}
+
+template <typename Type, typename Policy>
+	std::mutex &thread_reader<Type, Policy>::mutex_()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+template <typename Type, typename Policy>
+	typename thread_reader<Type, Policy>::thread_slots
+	&thread_reader<Type, Policy>::slots_()
+{
+	static thread_local thread_slots slots;
+	return slots;
+}
+
+template <typename Type, typename Policy>
+	thread_reader<Type, Policy>::slot::slot(
+	reader_ptr<Type, Policy> &prototype) : reader_(prototype), parent_(nullptr),
+	next_(nullptr), prev_sibling_(nullptr), next_sibling_(nullptr) {}
+
+template <typename Type, typename Policy>
+	thread_reader<Type, Policy>::thread_slots::thread_slots() : head_(nullptr)
+	{}
+
+template <typename Type, typename Policy>
+	thread_reader<Type, Policy>::thread_slots::~thread_slots()
+{
+	std::lock_guard<std::mutex> guard(mutex_());
+	(void)guard; // Remove 'unused' warnings.
+	while (head_ != nullptr)
+	{
+		slot *it = head_;
+		head_ = it->next_;
+		thread_reader<Type, Policy> *parent =
+			it->parent_.load(std::memory_order_relaxed);
+		if (parent != nullptr)
+		{
+			if (it->prev_sibling_ != nullptr)
+			{
+				it->prev_sibling_->next_sibling_ = it->next_sibling_;
+			}
+			else
+			{
+				parent->siblings_ = it->next_sibling_;
+			}
+			if (it->next_sibling_ != nullptr)
+			{
+				it->next_sibling_->prev_sibling_ = it->prev_sibling_;
+			}
+		}
+		delete it;
+	}
+}
+
+template <typename Type, typename Policy, typename... Args>
+	owned_ptr<Type, Policy> make_owned(Args &&... args)
+{
+	owned_ptr<Type, Policy> owner;
+	owner.emplace(std::forward<Args>(args)...);
+	return owner;
+}
+
+template <typename... Types, typename... Policies> std::tuple<Types *...>
+	lock_all(reader_ptr<Types, Policies> &... readers)
+{
+	// Registry readers publish their hazards first, then share one fence, and
+	// only then check their values. Braces keep the calls in order.
+	int expand[] = {0, (readers.stage_(), 0)...};
+	(void)expand; // Remove 'unused' warnings.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return std::tuple<Types *...>{readers.confirm_()...};
+}
+
+#ifdef OWNED_PTR_ENABLE_STATS
+inline owned_stats owned_global_stats()
+{
+	owned_stats out;
+	owned_detail::stats::read_global(out);
+	return out;
+}
+#endif
+
+template <typename... Types, typename... Policies> void unlock_all(
+	reader_ptr<Types, Policies> &... readers)
+{
+	// Expands the calls in order, without a recursive helper.
+	int expand[] = {0, (readers.unlock(), 0)...};
+	(void)expand; // Remove 'unused' warnings.
+}
+
+template <typename... Types, typename... Policies>
+	std::tuple<read_guard<Types, Policies>...> read_all(
+	reader_ptr<Types, Policies> &... readers)
+{
+	return std::tuple<read_guard<Types, Policies>...>(
+		read_guard<Types, Policies>(readers)...);
+}
+
+inline owned_domain::owned_domain() {}
+
+inline owned_domain::~owned_domain()
+{
+	release();
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	bool owned_domain::add(owned_ptr<Type, Policy, Deleter> &owner)
+{
+	typedef owned_ptr<Type, Policy, Deleter> owner_type;
+	member entry = {&owner, nullptr, &invalidate_<owner_type>,
+		&drain_<owner_type>};
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	for (auto &other : members_)
+	{
+		if (other.owner_ == &owner)
+		{
+			return false;
+		}
+	}
+	members_.push_back(entry);
+	return true;
+}
+
+template <typename Type, typename Policy, typename Deleter>
+	void owned_domain::remove(owned_ptr<Type, Policy, Deleter> &owner)
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	for (size_t i = 0; i < members_.size(); ++i)
+	{
+		if (members_[i].owner_ == &owner)
+		{
+			members_[i] = members_.back();
+			members_.pop_back();
+			return;
+		}
+	}
+}
+
+inline void owned_domain::release()
+{
+	owned_detail::trace_span span("owned_domain::release", this);
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+
+	// Every owner is unlocked again as soon as nothing is published, and is
+	// locked again only for its own drain_(). By the time the first owner is
+	// drained, the readers of the others have had as long to let go.
+	for (auto &entry : members_)
+	{
+		entry.old_ = entry.invalidate_(entry.owner_);
+	}
+	for (auto &entry : members_)
+	{
+		entry.drain_(entry.owner_, entry.old_);
+	}
+	members_.clear();
+}
+
+inline size_t owned_domain::count()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	return members_.size();
+}
+
+template <typename Owner> void *owned_domain::invalidate_(void *owner)
+{
+	return static_cast<Owner *>(owner)->withdraw_();
+}
+
+template <typename Owner> void owned_domain::drain_(void *owner, void *old)
+{
+	Owner *self = static_cast<Owner *>(owner);
+	self->redrain_(static_cast<decltype(self->invalidate_())>(old));
+}
+
+inline owned_reclaimer::owned_reclaimer(size_t limit) : limit_(limit),
+	count_(0), delay_(1), scheduled_(false), stopping_(false)
+{
+	thread_ = std::thread(&owned_reclaimer::run_, this);
+}
+
+inline owned_reclaimer::owned_reclaimer(const executor &run, size_t limit) :
+	executor_(run), limit_(limit), count_(0), delay_(1), scheduled_(false),
+	stopping_(false) {}
+
+inline owned_reclaimer::~owned_reclaimer()
+{
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		(void)guard; // Remove 'unused' warnings.
+		stopping_ = true;
+	}
+	ready_.notify_all();
+	if (thread_.joinable())
+	{
+		thread_.join();
+		return;
+	}
+
+	// The executor's sweeps may still be scheduled, and refer to this instance.
+	std::unique_lock<std::mutex> lock(mutex_);
+	ready_.wait(lock, [this]() { return !scheduled_; });
+	lock.unlock();
+	while (sweep() != 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+inline size_t owned_reclaimer::sweep()
+{
+	// Work is taken out of the list while it is polled, so that concurrent
+	// sweeps never poll the same work, and done() runs unlocked.
+	std::vector<work> batch;
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		(void)guard; // Remove 'unused' warnings.
+		batch.swap(work_);
+	}
+	std::vector<work> finished;
+	std::vector<work> left;
+	for (auto &item : batch)
+	{
+		(item.poll_() ? finished : left).push_back(std::move(item));
+	}
+	size_t count;
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		(void)guard; // Remove 'unused' warnings.
+		for (auto &item : left)
+		{
+			work_.push_back(std::move(item));
+		}
+		count_ -= finished.size();
+		count = count_;
+	}
+
+	// Only called once the work that is left is back in the list, where a
+	// destructor that it runs can sweep it.
+	for (auto &item : finished)
+	{
+		item.done_();
+	}
+	return count;
+}
+
+inline size_t owned_reclaimer::count()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	return count_;
+}
+
+inline bool owned_reclaimer::submit_(const std::function<bool()> &poll,
+	const std::function<void()> &done)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (count_ >= limit_)
+	{
+		return false;
+	}
+	work item = {poll, done};
+	work_.push_back(item);
+	++count_;
+	delay_ = std::chrono::milliseconds(1);
+	if (!executor_)
+	{
+		lock.unlock();
+		ready_.notify_one();
+		return true;
+	}
+	if (!scheduled_)
+	{
+		// Stays set until the sweep is done with this instance.
+		scheduled_ = true;
+		lock.unlock();
+		executor_([this]() { swept_(); }, std::chrono::milliseconds(0));
+	}
+	return true;
+}
+
+inline void owned_reclaimer::run_()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;)
+	{
+		if (count_ == 0)
+		{
+			if (stopping_)
+			{
+				return;
+			}
+			ready_.wait(lock);
+			continue;
+		}
+		lock.unlock();
+		size_t left = sweep();
+		lock.lock();
+		if (left != 0)
+		{
+			ready_.wait_for(lock, delay_);
+			if (delay_ < std::chrono::milliseconds(16))
+			{
+				delay_ *= 2;
+			}
+		}
+	}
+}
+
+inline void owned_reclaimer::swept_()
+{
+	sweep();
+
+	// Decided on count_ rather than on what the sweep returned, since work
+	// submitted meanwhile, or by done(), saw scheduled_ set and relies on
+	// this sweep to schedule the next one.
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (count_ == 0)
+	{
+		scheduled_ = false;
+		ready_.notify_all();
+		return;
+	}
+	std::chrono::milliseconds delay = delay_;
+	if (delay_ < std::chrono::milliseconds(16))
+	{
+		delay_ *= 2;
+	}
+	lock.unlock();
+	executor_([this]() { swept_(); }, delay);
+}
+
+inline owned_arena::owned_arena() : chunks_(nullptr), cursor_(nullptr),
+	end_(nullptr), size_(0) {}
+
+inline owned_arena::~owned_arena()
+{
+	release();
+}
+
+template <typename Type, typename... Args> Type *owned_arena::make(
+	Args &&... args)
+{
+	void *memory = allocate(sizeof(Type), std::alignment_of<Type>::value);
+	return new (memory) Type(std::forward<Args>(args)...);
+}
+
+inline void *owned_arena::allocate(size_t size, size_t align)
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	size_t offset = reinterpret_cast<size_t>(cursor_) % align;
+	char *memory = cursor_ + (offset == 0 ? 0 : align - offset);
+	if (cursor_ == nullptr || memory + size > end_)
+	{
+		// Values too big for a chunk get one of their own, so the current
+		// chunk's space is not wasted.
+		size_t capacity = sizeof(chunk) + align + size;
+		if (capacity < OWNED_PTR_ARENA_CHUNK)
+		{
+			capacity = OWNED_PTR_ARENA_CHUNK;
+		}
+		chunk *block = static_cast<chunk *>(::operator new(capacity));
+		block->next_ = chunks_;
+		block->size_ = capacity;
+		chunks_ = block;
+		size_ += capacity;
+
+		char *start = reinterpret_cast<char *>(block + 1);
+		offset = reinterpret_cast<size_t>(start) % align;
+		memory = start + (offset == 0 ? 0 : align - offset);
+		if (capacity == OWNED_PTR_ARENA_CHUNK || cursor_ == nullptr)
+		{
+			cursor_ = memory + size;
+			end_ = reinterpret_cast<char *>(block) + capacity;
+		}
+		return memory;
+	}
+	cursor_ = memory + size;
+	return memory;
+}
+
+inline void owned_arena::release()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	while (chunks_ != nullptr)
+	{
+		chunk *next = chunks_->next_;
+		::operator delete(chunks_);
+		chunks_ = next;
+	}
+	cursor_ = nullptr;
+	end_ = nullptr;
+	size_ = 0;
+}
+
+inline size_t owned_arena::size()
+{
+	std::lock_guard<std::mutex> guard(mutex_);
+	(void)guard; // Remove 'unused' warnings.
+	return size_;
+}
+
+template <typename Type> void arena_delete<Type>::operator()(Type *value) const
+{
+	value->~Type();
+}
+
+template <typename Type> owned_value<Type>::owned_value() : sequence_(0)
+{
+	store_(Type());
+}
+
+template <typename Type> owned_value<Type>::owned_value(const Type &value) :
+	sequence_(0)
+{
+	store_(value);
+}
+
+template <typename Type> Type owned_value<Type>::load() const
+{
+	std::uintptr_t words[words_];
+	for (;;)
+	{
+		size_t sequence = sequence_.load(std::memory_order_acquire);
+		if (sequence % 2 == 0)
+		{
+			// Pairs with store_(). If any word was written by a writer that is
+			// not done yet, the sequence below has changed.
+			for (size_t i = 0; i < words_; ++i)
+			{
+				words[i] = value_[i].load(std::memory_order_acquire);
+			}
+			if (sequence_.load(std::memory_order_relaxed) == sequence)
+			{
+				break;
+			}
+		}
+		std::this_thread::yield();
+	}
+	typename std::aligned_storage<sizeof(Type),
+		std::alignment_of<Type>::value>::type out;
+	std::memcpy(&out, words, sizeof(Type));
+	return *reinterpret_cast<Type *>(&out);
+}
+
+template <typename Type> void owned_value<Type>::reset(const Type &value)
+{
+	size_t sequence = sequence_.load(std::memory_order_relaxed);
+	// Acquires the last writer's value, so that words are written in order.
+	while (sequence % 2 != 0 || !sequence_.compare_exchange_weak(sequence,
+		sequence + 1, std::memory_order_acquire))
+	{
+		std::this_thread::yield();
+		sequence = sequence_.load(std::memory_order_relaxed);
+	}
+	store_(value);
+	sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+template <typename Type> void owned_value<Type>::store_(const Type &value)
+{
+	std::uintptr_t words[words_] = {};
+	std::memcpy(words, &value, sizeof(Type));
+	for (size_t i = 0; i < words_; ++i)
+	{
+		value_[i].store(words[i], std::memory_order_release);
+	}
+}
+
+template <typename Type> registry_policy::owner<Type>::owner(Type *value) :
+	value_(value), children_(nullptr), size_(0), table_(value) {}
+
+template <typename Type> registry_policy::owner<Type>::~owner()
+{
+	mutex_.lock();
+	clear_();
+	mutex_.unlock();
+}
+
+template <typename Type> void registry_policy::owner<Type>::attach_(
+	reader<Type> &child)
+{
+	// Leaves any previous owner before taking this owner's lock, so that
+	// re-pairing a reader with the same owner does not deadlock.
+	child.set_owner_(this);
+	links_.lock();
+	child.value_.store(value_, std::memory_order_release);
+	link_(&child);
+	links_.unlock();
+}
+
+template <typename Type> template <typename Iterator>
+	void registry_policy::owner<Type>::attach_many_(Iterator first,
+	Iterator last)
+{
+	// Leaves any previous owners first, as attach_() does.
+	for (Iterator it = first; it != last; ++it)
+	{
+		(*it).core_.set_owner_(this);
+	}
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	for (Iterator it = first; it != last; ++it)
+	{
+		reader<Type> &child = (*it).core_;
+		child.value_.store(value_, std::memory_order_release);
+		link_(&child);
+	}
+}
+
+template <typename Type> template <typename Iterator>
+	void registry_policy::owner<Type>::detach_many_(Iterator first,
+	Iterator last)
+{
+	links_.lock();
+	for (Iterator it = first; it != last; ++it)
+	{
+		reader<Type> &child = (*it).core_;
+		while (!detach_(child))
+		{
+			// The reader is being copied or moved, as clear_() describes.
+			links_.unlock();
+			std::this_thread::yield();
+			links_.lock();
+		}
+	}
+	links_.unlock();
+}
+
+template <typename Type> void registry_policy::owner<Type>::remove_(
+	reader<Type> *child)
+{
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	unlink_(child);
+}
+
+template <typename Type> void registry_policy::owner<Type>::replace_(
+	reader<Type> *child, reader<Type> *with)
+{
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	assert(child->prev_ != nullptr || children_ == child);
+
+	// The lock moves over before the old reader leaves the list, so held_()
+	// and wait_until_() never miss it.
+	with->value_.store(child->value_.load(std::memory_order_relaxed),
+		std::memory_order_release);
+	with->locked_.store(child->locked_.load(std::memory_order_relaxed),
+		std::memory_order_seq_cst);
+	with->parent_.fetch_or(child->parent_.load(std::memory_order_relaxed) &
+		reader<Type>::waiting_bit_, std::memory_order_seq_cst);
+	with->prev_ = child->prev_;
+	with->next_ = child->next_;
+	if (with->prev_ != nullptr)
+	{
+		with->prev_->next_ = with;
+	}
+	else
+	{
+		children_ = with;
+	}
+	if (with->next_ != nullptr)
+	{
+		with->next_->prev_ = with;
+	}
+	child->prev_ = nullptr;
+	child->next_ = nullptr;
+	child->value_.store(nullptr, std::memory_order_relaxed);
+	child->locked_.store(nullptr, std::memory_order_relaxed);
+}
+
+template <typename Type> bool registry_policy::owner<Type>::prepare_until_(
+	const time_point &)
+{
+	return true;
+}
+
+template <typename Type> Type *registry_policy::owner<Type>::current_()
+{
+	return value_;
+}
+
+template <typename Type> Type *registry_policy::owner<Type>::publish_(
+	Type *value)
+{
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	Type *old = value_;
+	value_ = value;
+	for (auto child = children_; child != nullptr; child = child->next_)
+	{
+		child->value_.store(value, std::memory_order_seq_cst);
+	}
+	table_.publish(value);
+	return old;
+}
+
+template <typename Type> bool registry_policy::owner<Type>::held_(Type *value)
+{
+	// Pairs with reader::lock_(). A reader either sees the new value when it
+	// validates, or its hazard slot is visible here.
+	if (value == nullptr)
+	{
+		return false;
+	}
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	for (auto child = children_; child != nullptr; child = child->next_)
+	{
+		if (child->locked_.load(std::memory_order_seq_cst) == value)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename Type> void registry_policy::owner<Type>::wait_(Type *value)
+{
+	wait_until_(value, time_point::max());
+}
+
+template <typename Type> bool registry_policy::owner<Type>::wait_until_(
+	Type *value, const time_point &deadline)
+{
+	// Every reader was given a newer value by publish_(), so once no listed
+	// reader holds the old value, none can lock it again. The readers that
+	// hold it are marked first, so that unlocking wakes this writer, and the
+	// writer sleeps on the owner's address without links_.
+	if (value == nullptr)
+	{
+		return true;
+	}
+	{
+		std::lock_guard<std::mutex> guard(links_);
+		(void)guard; // Remove 'unused' warnings.
+		bool held = false;
+		for (auto child = children_; child != nullptr; child = child->next_)
+		{
+			if (child->locked_.load(std::memory_order_seq_cst) == value)
+			{
+				child->parent_.fetch_or(reader<Type>::waiting_bit_,
+					std::memory_order_seq_cst);
+				held = true;
+			}
+		}
+		if (!held)
+		{
+			return true;
+		}
+	}
+	owned_detail::null_flag waiting;
+	bool unlocked = owned_detail::parking::wait_until(this, waiting,
+		[this, value]()
+		{
+			return !held_(value);
+		}, deadline);
+
+	// Readers that left meanwhile keep their mark, which only costs them a
+	// spare wake-up.
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	for (auto child = children_; child != nullptr; child = child->next_)
+	{
+		child->parent_.fetch_and(~std::uintptr_t(reader<Type>::waiting_bit_),
+			std::memory_order_relaxed);
+	}
+	return unlocked;
+}
+
+template <typename Type> size_t registry_policy::owner<Type>::count_()
+{
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	return size_;
+}
+
+template <typename Type> owned_detail::pin_table<Type>
+	&registry_policy::owner<Type>::pins_()
+{
+	return table_;
+}
+
+template <typename Type> size_t registry_policy::owner<Type>::count_locked_()
+{
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	size_t locked = 0;
+	for (auto child = children_; child != nullptr; child = child->next_)
+	{
+		if (child->locked_.load(std::memory_order_relaxed) != nullptr)
+		{
+			++locked;
+		}
+	}
+	return locked;
+}
+
+template <typename Type> void registry_policy::owner<Type>::clear_()
+{
+	std::unique_lock<std::mutex> lock(links_);
+	while (children_ != nullptr)
+	{
+		if (!detach_(*children_))
+		{
+			// The reader's thread is leaving, and waits for links_.
+			lock.unlock();
+			std::this_thread::yield();
+			lock.lock();
+		}
+	}
+}
+
+template <typename Type> void registry_policy::owner<Type>::take_(
+	owner<Type> &other)
+{
+	// Each reader is pointed at this owner in turn, backing off as clear_()
+	// does. A reader that leaves afterwards waits for this owner's lock, so
+	// the list can still be taken over as a whole.
+	std::uintptr_t self = reinterpret_cast<std::uintptr_t>(this);
+	std::lock_guard<std::mutex> guard(links_);
+	(void)guard; // Remove 'unused' warnings.
+	std::unique_lock<std::mutex> lock(other.links_);
+	reader<Type> *child = other.children_;
+	while (child != nullptr)
+	{
+		// A waiting writer's mark is kept, as unlock_parent_() does.
+		std::uintptr_t word = reinterpret_cast<std::uintptr_t>(&other);
+		std::uintptr_t waiting = reader<Type>::waiting_bit_ &
+			child->parent_.load(std::memory_order_relaxed);
+		word |= waiting;
+		if (child->parent_.compare_exchange_strong(word, self | waiting,
+			std::memory_order_acq_rel) ||
+			(word & ~std::uintptr_t(reader<Type>::locked_bit_ |
+			reader<Type>::waiting_bit_)) == self)
+		{
+			child = child->next_;
+		}
+		else
+		{
+			lock.unlock();
+			std::this_thread::yield();
+			lock.lock();
+			child = other.children_;
+		}
+	}
+	assert(children_ == nullptr);
+	value_ = other.value_;
+	children_ = other.children_;
+	size_ = other.size_;
+	table_.take(other.table_);
+	other.value_ = nullptr;
+	other.children_ = nullptr;
+	other.size_ = 0;
+}
+
+template <typename Type> bool registry_policy::owner<Type>::detach_(
+	reader<Type> &child)
+{
+	// The reader's word is this owner, perhaps marked by a waiting writer,
+	// unless it belongs to another owner, or is locked.
+	std::uintptr_t self = reinterpret_cast<std::uintptr_t>(this);
+	std::uintptr_t word = child.parent_.load(std::memory_order_relaxed);
+	while ((word & ~std::uintptr_t(reader<Type>::waiting_bit_)) == self)
+	{
+		if (!child.parent_.compare_exchange_weak(word,
+			word | reader<Type>::locked_bit_, std::memory_order_acquire,
+			std::memory_order_relaxed))
+		{
+			continue;
+		}
+
+		// The reader's thread may delete it as soon as it is unlocked. Only
+		// now is it known to be this owner's, so only now is it unlocked.
+		child.locked_.store(nullptr, std::memory_order_release);
+		child.value_.store(nullptr, std::memory_order_relaxed);
+		unlink_(&child);
+		child.parent_.store(0, std::memory_order_release);
+		return true;
+	}
+	return (word & ~std::uintptr_t(reader<Type>::locked_bit_ |
+		reader<Type>::waiting_bit_)) != self;
+}
+
+template <typename Type> void registry_policy::owner<Type>::link_(
+	reader<Type> *child)
+{
+	child->prev_ = nullptr;
+	child->next_ = children_;
+	if (children_ != nullptr)
+	{
+		children_->prev_ = child;
+	}
+	children_ = child;
+	++size_;
+}
+
+template <typename Type> void registry_policy::owner<Type>::unlink_(
+	reader<Type> *child)
+{
+	assert(child->prev_ != nullptr || children_ == child);
+	if (child->prev_ != nullptr)
+	{
+		child->prev_->next_ = child->next_;
+	}
+	else
+	{
+		children_ = child->next_;
+	}
+	if (child->next_ != nullptr)
+	{
+		child->next_->prev_ = child->prev_;
+	}
+	child->prev_ = nullptr;
+	child->next_ = nullptr;
+	--size_;
+}
+
+template <typename Type> registry_policy::reader<Type>::reader() :
+	value_(nullptr), locked_(nullptr), prev_(nullptr), next_(nullptr),
+	parent_(0) {}
+
+template <typename Type> registry_policy::reader<Type>::reader(
+	reader<Type> &other) : reader<Type>()
+{
+	owner<Type> *parent = other.lock_parent_();
+	if (parent != nullptr)
+	{
+		parent->attach_(*this);
+	}
+	other.unlock_parent_(parent);
+}
+
+template <typename Type> registry_policy::reader<Type>::reader(
+	reader<Type> &&other) : reader<Type>()
+{
+	assign_(other);
+}
+
+template <typename Type> registry_policy::reader<Type>::~reader()
+{
+	// A writer may be waiting for this reader, so it is woken up first.
+	unlock_();
+	owner<Type> *parent = lock_parent_();
+	if (parent != nullptr)
+	{
+		parent->remove_(this);
+	}
+}
+
+template <typename Type> Type *registry_policy::reader<Type>::lock_()
+{
+	Type *value = value_.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		// Pairs with owner::held_() and owner::wait_(). Either the writer sees
+		// this hazard, or the load below sees the writer's value.
+		locked_.store(value, std::memory_order_seq_cst);
+		Type *current = value_.load(std::memory_order_seq_cst);
+		if (current == value)
+		{
+			return value;
+		}
+		value = current;
+	}
+}
+
+template <typename Type> void registry_policy::reader<Type>::stage_()
+{
+	// The first half of lock_(), for lock_all(). The fence that makes this
+	// hazard visible is shared with the other readers locked at once.
+	locked_.store(value_.load(std::memory_order_relaxed),
+		std::memory_order_relaxed);
+}
+
+template <typename Type> Type *registry_policy::reader<Type>::confirm_()
+{
+	// Called after a seq_cst fence that follows stage_().
+	Type *value = locked_.load(std::memory_order_relaxed);
+	if (value_.load(std::memory_order_seq_cst) == value)
+	{
+		return value;
+	}
+	return lock_();
+}
+
+template <typename Type> void registry_policy::reader<Type>::unlock_()
+{
+	// A full fence here would make every unlock() slower. Without it, a writer
+	// that starts to sleep at the same time wakes up on its own time limit.
+	locked_.store(nullptr, std::memory_order_release);
+	std::uintptr_t word = parent_.load(std::memory_order_relaxed);
+	if (word & waiting_bit_)
+	{
+		// The owner is only used as the key, so it may be gone already.
+		owned_detail::parking::notify(reinterpret_cast<const void *>(word &
+			~std::uintptr_t(locked_bit_ | waiting_bit_)));
+	}
+}
+
+template <typename Type> owned_detail::pin<Type>
+	*registry_policy::reader<Type>::pin_()
+{
+	owner<Type> *parent = lock_parent_();
+	owned_detail::pin<Type> *held = parent == nullptr ? nullptr :
+		parent->table_.acquire();
+	unlock_parent_(parent);
+	return held;
+}
+
+template <typename Type> void registry_policy::reader<Type>::set_owner_(
+	owner<Type> *parent)
+{
+	owner<Type> *old = lock_parent_();
+	if (old != nullptr)
+	{
+		old->remove_(this);
+	}
+	unlock_parent_(parent);
+}
+
+template <typename Type> void registry_policy::reader<Type>::assign_(
+	reader<Type> &other)
+{
+	unlock_();
+	set_owner_(nullptr);
+	value_.store(nullptr, std::memory_order_relaxed);
+	owner<Type> *parent = other.lock_parent_();
+	if (parent != nullptr)
+	{
+		// This reader is not linked, so no other thread can see it yet.
+		parent_.store(reinterpret_cast<std::uintptr_t>(parent),
+			std::memory_order_relaxed);
+		parent->replace_(&other, this);
+	}
+	other.unlock_parent_(nullptr);
+}
+
+template <typename Type> registry_policy::owner<Type>
+	*registry_policy::reader<Type>::lock_parent_()
+{
+	static_assert(std::alignment_of<owner<Type>>::value > waiting_bit_,
+		"the owner's address has no room for the reader's flags");
+	for (;;)
+	{
+		std::uintptr_t word = parent_.load(std::memory_order_relaxed);
+		if ((word & locked_bit_) == 0 && parent_.compare_exchange_weak(word,
+			word | locked_bit_, std::memory_order_acquire,
+			std::memory_order_relaxed))
+		{
+			return reinterpret_cast<owner<Type> *>(word &
+				~std::uintptr_t(waiting_bit_));
+		}
+		std::this_thread::yield();
+	}
+}
+
+template <typename Type> void registry_policy::reader<Type>::unlock_parent_(
+	owner<Type> *parent)
+{
+	// Keeps the waiting bit, which a writer may change at the same time, as
+	// long as the reader stays with the same owner. A reader that left the
+	// list is no longer seen by the writer, so its mark is dropped.
+	std::uintptr_t self = reinterpret_cast<std::uintptr_t>(parent);
+	std::uintptr_t word = parent_.load(std::memory_order_relaxed);
+	while (!parent_.compare_exchange_weak(word, self |
+		((word & ~std::uintptr_t(locked_bit_ | waiting_bit_)) == self ?
+		word & waiting_bit_ : 0), std::memory_order_release,
+		std::memory_order_relaxed)) {}
+}
+
+template <std::size_t Shards> template <typename Type>
+	sharded_policy<Shards>::owner<Type>::state::state(Type *value) :
+	value_(value), generation_(0), waiting_(false), table_(value)
+{
+	refs_.count_.store(1, std::memory_order_relaxed);
+	for (std::size_t i = 0; i < 2 * Shards; ++i)
+	{
+		readers_[i / Shards][i % Shards].count_.store(0,
+			std::memory_order_relaxed);
+	}
+}
+
+template <std::size_t Shards> template <typename Type>
+	sharded_policy<Shards>::owner<Type>::owner(Type *value) :
+	state_(new state(value)), previous_(nullptr) {}
+
+template <std::size_t Shards> template <typename Type>
+	sharded_policy<Shards>::owner<Type>::~owner()
+{
+	release_(state_);
+}
+
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::owner<Type>::attach_(reader<Type> &child)
+{
+	// The reader's lock is counted in its old state, so it must let go of it
+	// before leaving.
+	child.unlock_();
+	state_->refs_.count_.fetch_add(1, std::memory_order_relaxed);
+	release_(child.state_);
+	child.state_ = state_;
+}
+
+template <std::size_t Shards> template <typename Type>
+	template <typename Iterator>
+	void sharded_policy<Shards>::owner<Type>::attach_many_(Iterator first,
+	Iterator last)
+{
+	// This owner's reference keeps its state alive while readers are counted
+	// in one go at the end.
+	size_t added = 0;
+	for (Iterator it = first; it != last; ++it)
+	{
+		reader<Type> &child = (*it).core_;
+		child.unlock_();
+		if (child.state_ != state_)
+		{
+			release_(child.state_);
+			child.state_ = state_;
+			++added;
+		}
+	}
+	state_->refs_.count_.fetch_add(added, std::memory_order_relaxed);
+}
+
+template <std::size_t Shards> template <typename Type>
+	template <typename Iterator>
+	void sharded_policy<Shards>::owner<Type>::detach_many_(Iterator first,
+	Iterator last)
+{
+	size_t removed = 0;
+	for (Iterator it = first; it != last; ++it)
+	{
+		reader<Type> &child = (*it).core_;
+		if (child.state_ == state_)
+		{
+			child.unlock_();
+			child.state_ = nullptr;
+			++removed;
+		}
+	}
+	state_->refs_.count_.fetch_sub(removed, std::memory_order_release);
+}
+
+template <std::size_t Shards> template <typename Type>
+	bool sharded_policy<Shards>::owner<Type>::prepare_until_(
+	const time_point &deadline)
 {
-public:
+	// The next generation reuses the count of the generation before the
+	// current one. Readers that still use its value must leave first.
+	unsigned generation = state_->generation_.load(std::memory_order_relaxed);
+	state *shared = state_;
+	return owned_detail::parking::wait_until(shared, shared->waiting_,
+		[shared, generation]()
+		{
+			return drained_(shared, (generation + 1) & 1);
+		}, deadline);
+}
 
-	/**
-	 * @brief  Creates an instance without a value.
-	 */
-	owned_ptr();
+template <std::size_t Shards> template <typename Type>
+	Type *sharded_policy<Shards>::owner<Type>::current_()
+{
+	return state_->value_.load(std::memory_order_relaxed);
+}
 
-	/**
-	 * @brief  Creates an instance with the given value.
-	 *
-	 * The given variable is owned by the owned_ptr instance. It is managed and
-	 * deleted by this instance.
-	 */
-	explicit owned_ptr(Type *value);
+template <std::size_t Shards> template <typename Type>
+	Type *sharded_policy<Shards>::owner<Type>::publish_(Type *value)
+{
+	prepare_until_(time_point::max());
+	unsigned generation = state_->generation_.load(std::memory_order_relaxed);
 
-	/**
-	 * @brief  Deallocates associated data and invalidates all readers.
-	 *
-	 * If a reader is currently accessing the values, then this function will
-	 * wait for the reader to be unlocked before deleting.
-	 */
-	~owned_ptr();
+	// Pairs with reader::lock_(). The value is published before the
+	// generation, so a reader counted under the new generation always sees the
+	// new value. A reader may still see the new value under the old
+	// generation; it is waited on with the old value's readers, and by
+	// prepare_until_() before the count is reused.
+	previous_ = state_->value_.load(std::memory_order_relaxed);
+	state_->value_.store(value, std::memory_order_seq_cst);
+	state_->generation_.store(generation + 1, std::memory_order_seq_cst);
+	state_->table_.publish(value);
+	return previous_;
+}
 
-	/**
-	 * @brief  Pairs the reader instance with this instance.
-	 *
-	 * If the given reader is already locked, then the reader will not be able
-	 * to obtain its new value until it makes another call to lock().
-	 */
-	void get(reader_ptr<Type> &reader);
+template <std::size_t Shards> template <typename Type>
+	bool sharded_policy<Shards>::owner<Type>::held_(Type *value)
+{
+	if (value == nullptr)
+	{
+		return false;
+	}
+	unsigned generation = state_->generation_.load(std::memory_order_relaxed);
+	if (value == state_->value_.load(std::memory_order_relaxed))
+	{
+		return !drained_(state_, generation & 1);
+	}
+	if (value == previous_)
+	{
+		return !drained_(state_, (generation - 1) & 1);
+	}
+	return false;
+}
 
-	/**
-	 * @brief  Changes the value type.
-	 *
-	 * This function is blocked until not readers are using the value. The given
-	 * variable is owned by this instance. It is managed and deleted by this
-	 * instance.
-	 */
-	void reset(Type *value);
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::owner<Type>::wait_(Type *value)
+{
+	wait_until_(value, time_point::max());
+}
 
-	/**
-	 * @brief  Returns the number of readers.
-	 */
-	size_t count();
+template <std::size_t Shards> template <typename Type>
+	bool sharded_policy<Shards>::owner<Type>::wait_until_(Type *value,
+	const time_point &deadline)
+{
+	return owned_detail::parking::wait_until(state_, state_->waiting_,
+		[this, value]()
+		{
+			return !held_(value);
+		}, deadline);
+}
 
-protected:
-	friend class reader_ptr<Type>;
-	void remove_(reader_ptr<Type> *child);
-	void replace_(reader_ptr<Type> *reader, reader_ptr<Type> *with);
-	std::mutex mutex_;
-	Type *value_;
-private:
-	DISALLOW_COPY_AND_ASSIGN(owned_ptr<Type>);
-	std::deque<reader_ptr<Type>*> children_;
-	std::list<reader_ptr<Type>*> update_;
-};
+template <std::size_t Shards> template <typename Type>
+	size_t sharded_policy<Shards>::owner<Type>::count_()
+{
+	return state_->refs_.count_.load(std::memory_order_relaxed) - 1;
+}
 
-/**
- * @brief  A class that reads data from a referenced owned pointer.
- */
-template <typename Type> class reader_ptr
+template <std::size_t Shards> template <typename Type>
+	owned_detail::pin_table<Type> &sharded_policy<Shards>::owner<Type>::pins_()
 {
-public:
+	return state_->table_;
+}
 
-	/**
-	 * @brief  Creates an instance without a referenced owner.
-	 */
-	reader_ptr();
+template <std::size_t Shards> template <typename Type>
+	size_t sharded_policy<Shards>::owner<Type>::count_locked_()
+{
+	// Readers that are retrying their lock are counted too.
+	size_t locked = 0;
+	for (std::size_t i = 0; i < 2 * Shards; ++i)
+	{
+		locked += state_->readers_[i / Shards][i % Shards].count_.load(
+			std::memory_order_relaxed);
+	}
+	return locked;
+}
 
-	/**
-	 * @brief  Creates an instance with a referenced owner.
-	 */
-	explicit reader_ptr(owned_ptr<Type> *owner);
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::owner<Type>::clear_()
+{
+	// Readers keep the old state, where they only ever see nullptr.
+	if (state_->refs_.count_.load(std::memory_order_acquire) != 1)
+	{
+		release_(state_);
+		state_ = new state(nullptr);
+	}
+	previous_ = nullptr;
+}
 
-	/**
-	 * @brief  Creates an instance with the same owner as the given reader.
-	 */
-	reader_ptr(reader_ptr<Type> &other);
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::owner<Type>::take_(owner<Type> &other)
+{
+	// The readers share the state, so they move with it in one step. This
+	// owner's state has no readers, and is left to the other owner.
+	std::swap(state_, other.state_);
+	std::swap(previous_, other.previous_);
+}
 
-	/**
-	 * @brief  Creates an instance by replacing the given reader.
-	 */
-	reader_ptr(reader_ptr<Type> &&other);
+template <std::size_t Shards> template <typename Type>
+	bool sharded_policy<Shards>::owner<Type>::drained_(state *shared,
+	unsigned parity)
+{
+	// A reader locks and unlocks in the same shard, so each shard is checked
+	// on its own rather than summed.
+	for (std::size_t i = 0; i < Shards; ++i)
+	{
+		if (shared->readers_[parity][i].count_.load(
+			std::memory_order_seq_cst) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
 
-	/**
-	 * @brief  Removes itself from its referenced owner.
-	 */
-	~reader_ptr();
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::owner<Type>::release_(state *shared)
+{
+	if (shared != nullptr &&
+		shared->refs_.count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete shared;
+	}
+}
 
-	/**
-	 * @brief  Locks the owner's value.
-	 * @return The owner's value if the owner still exists, or nullptr if there
-	 *         is no owner, or the owner has been deleted.
-	 * @see    unlock();
-	 *
-	 * Multiple readers may lock simultaneously. If an owner's value has
-	 * changed after calling this method, then this method must be called again
-	 * to recieve the new value.
-	 */
-	Type *lock();
+template <std::size_t Shards> template <typename Type>
+	sharded_policy<Shards>::reader<Type>::reader() : state_(nullptr),
+	locked_(0) {}
 
-	/**
-	 * @brief  Unlocks the owner's value.
-	 */
-	void unlock();
+template <std::size_t Shards> template <typename Type>
+	sharded_policy<Shards>::reader<Type>::reader(reader<Type> &other) :
+	state_(other.state_), locked_(0)
+{
+	if (state_ != nullptr)
+	{
+		state_->refs_.count_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
 
-protected:
-	friend class owned_ptr<Type>;
-	void set_owner_(owned_ptr<Type> *owner);
-	Type *value_;
-	Type *locked_;
-private:
-	std::mutex mutex_;
-	owned_ptr<Type> *parent_;
-};
+template <std::size_t Shards> template <typename Type>
+	sharded_policy<Shards>::reader<Type>::reader(reader<Type> &&other) :
+	state_(other.state_), locked_(other.locked_)
+{
+	other.state_ = nullptr;
+	other.locked_ = 0;
+}
+
+template <std::size_t Shards> template <typename Type>
+	sharded_policy<Shards>::reader<Type>::~reader()
+{
+	unlock_();
+	owner<Type>::release_(state_);
+}
+
+template <std::size_t Shards> template <typename Type>
+	Type *sharded_policy<Shards>::reader<Type>::lock_()
+{
+	unlock_();
+	if (state_ == nullptr)
+	{
+		return nullptr;
+	}
+	unsigned shard = shard_();
+	for (;;)
+	{
+		// Pairs with owner::publish_(). If the generation is unchanged after
+		// the value is read, the value is no older than that generation and a
+		// writer retiring it sees this reader in its count.
+		unsigned generation = state_->generation_.load(std::memory_order_seq_cst);
+		std::atomic<size_t> &count =
+			state_->readers_[generation & 1][shard].count_;
+		count.fetch_add(1, std::memory_order_seq_cst);
+		Type *value = state_->value_.load(std::memory_order_seq_cst);
+		if (state_->generation_.load(std::memory_order_seq_cst) == generation)
+		{
+			if (value == nullptr)
+			{
+				leave_(count);
+				return nullptr;
+			}
+			locked_ = (generation & 1) * Shards + shard + 1;
+			return value;
+		}
+		leave_(count);
+	}
+}
 
-template <typename Type> owned_ptr<Type>::owned_ptr() : value_(nullptr) {}
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::reader<Type>::stage_() {}
 
-template <typename Type> owned_ptr<Type>::owned_ptr(Type *value) :
-	value_(value) {}
+template <std::size_t Shards> template <typename Type>
+	Type *sharded_policy<Shards>::reader<Type>::confirm_()
+{
+	// The counters are full barriers of their own, so nothing is shared.
+	return lock_();
+}
 
-template <typename Type> owned_ptr<Type>::~owned_ptr()
+template <std::size_t Shards> template <typename Type>
+	owned_detail::pin<Type> *sharded_policy<Shards>::reader<Type>::pin_()
 {
-	mutex_.lock();
-	for (auto &child : children_)
+	return state_ == nullptr ? nullptr : state_->table_.acquire();
+}
+
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::reader<Type>::unlock_()
+{
+	if (locked_ != 0)
+	{
+		unsigned index = locked_ - 1;
+		locked_ = 0;
+		leave_(state_->readers_[index / Shards][index % Shards].count_);
+	}
+}
+
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::reader<Type>::leave_(
+	std::atomic<size_t> &count)
+{
+	// The decrement is a full fence already, so the writer's mark is checked
+	// exactly and no wake-up is missed.
+	count.fetch_sub(1, std::memory_order_seq_cst);
+	if (state_->waiting_.load(std::memory_order_seq_cst))
+	{
+		owned_detail::parking::notify(state_);
+	}
+}
+
+template <std::size_t Shards> template <typename Type>
+	void sharded_policy<Shards>::reader<Type>::assign_(reader<Type> &other)
+{
+	unlock_();
+	owner<Type>::release_(state_);
+	state_ = other.state_;
+	locked_ = other.locked_;
+	other.state_ = nullptr;
+	other.locked_ = 0;
+}
+
+template <std::size_t Shards> template <typename Type>
+	unsigned sharded_policy<Shards>::reader<Type>::shard_()
+{
+	if (Shards == 1)
+	{
+		return 0;
+	}
+
+	// Threads are given shards in turn the first time they lock.
+	static std::atomic<unsigned> next(0);
+	static thread_local unsigned shard =
+		next.fetch_add(1, std::memory_order_relaxed) % Shards;
+	return shard;
+}
+
+template <typename Type> single_thread_policy::owner<Type>::owner(Type *value) :
+	value_(value), children_(nullptr), size_(0), table_(value) {}
+
+template <typename Type> single_thread_policy::owner<Type>::~owner()
+{
+	clear_();
+}
+
+template <typename Type> void single_thread_policy::owner<Type>::attach_(
+	reader<Type> &child)
+{
+	child.unlock_();
+	if (child.parent_ != nullptr)
+	{
+		child.parent_->unlink_(&child);
+	}
+	child.parent_ = this;
+	link_(&child);
+}
+
+template <typename Type> template <typename Iterator>
+	void single_thread_policy::owner<Type>::attach_many_(Iterator first,
+	Iterator last)
+{
+	for (Iterator it = first; it != last; ++it)
+	{
+		attach_((*it).core_);
+	}
+}
+
+template <typename Type> template <typename Iterator>
+	void single_thread_policy::owner<Type>::detach_many_(Iterator first,
+	Iterator last)
+{
+	for (Iterator it = first; it != last; ++it)
 	{
-		child->value_ = nullptr;
-		child->set_owner_(nullptr);
-		while (child->locked_ != nullptr)
+		reader<Type> &child = (*it).core_;
+		if (child.parent_ == this)
 		{
-			std::this_thread::yield();
+			child.unlock_();
+			child.parent_ = nullptr;
+			unlink_(&child);
 		}
 	}
-	delete value_;
-	mutex_.unlock();
 }
 
-template <typename Type> void owned_ptr<Type>::get(reader_ptr<Type> &reader)
+template <typename Type> bool single_thread_policy::owner<Type>::prepare_until_(
+	const time_point &)
 {
-	mutex_.lock();
-	reader.value_ = value_;
-	reader.set_owner_(this);
-	children_.push_back(&reader);
-	mutex_.unlock();
+	return true;
 }
 
-template <typename Type> void owned_ptr<Type>::reset(Type *value)
+template <typename Type> Type *single_thread_policy::owner<Type>::current_()
 {
-	mutex_.lock();
-	for (auto &child : children_)
+	return value_;
+}
+
+template <typename Type> Type *single_thread_policy::owner<Type>::publish_(
+	Type *value)
+{
+	Type *old = value_;
+	value_ = value;
+	table_.publish(value);
+	return old;
+}
+
+template <typename Type> bool single_thread_policy::owner<Type>::held_(
+	Type *value)
+{
+	if (value == nullptr)
 	{
-		child->value_ = value;
-		if (child->locked_ != nullptr)
+		return false;
+	}
+	for (auto child = children_; child != nullptr; child = child->next_)
+	{
+		if (child->locked_ == value)
 		{
-			update_.push_back(child);
+			return true;
 		}
 	}
-	while (!update_.empty())
+	return false;
+}
+
+template <typename Type> void single_thread_policy::owner<Type>::wait_(
+	Type *value)
+{
+	// Only this thread could unlock the readers, so waiting would never end.
+	// The readers keep the value instead, and once the caller disposes of it,
+	// the last of them to let go deletes it.
+	if (value == nullptr)
+	{
+		return;
+	}
+	for (auto child = children_; child != nullptr; child = child->next_)
 	{
-		for (auto child = update_.begin(); child != update_.end(); ++child)
+		if (child->locked_ == value)
 		{
-			if ((*child)->locked_ == nullptr || (*child)->locked_ == value)
-			{
-				update_.erase(child);
-			}
+			assert(child->kept_ == nullptr);
+			child->kept_ = table_.keep(value);
+			child->locked_ = nullptr;
 		}
 	}
-	delete value_;
-	value_ = value;
-	mutex_.unlock();
 }
 
-template <typename Type> size_t owned_ptr<Type>::count()
+template <typename Type> bool single_thread_policy::owner<Type>::wait_until_(
+	Type *value, const time_point &)
 {
-	std::lock_guard<std::mutex> guard(mutex_);
-	(void)guard; // Remove 'unused' warnings.
-	return children_.size();
+	return !held_(value);
 }
 
-template <typename Type> void owned_ptr<Type>::remove_(reader_ptr<Type> *child)
+template <typename Type> size_t single_thread_policy::owner<Type>::count_()
 {
-	std::lock_guard<std::mutex> guard(mutex_);
-	(void)guard; // Remove 'unused' warnings.
+	return size_;
+}
 
-	auto i = children_.begin();
-	while (i != children_.end())
+template <typename Type> size_t
+	single_thread_policy::owner<Type>::count_locked_()
+{
+	size_t locked = 0;
+	for (auto child = children_; child != nullptr; child = child->next_)
 	{
-		if (*i == child)
+		if (child->locked_ != nullptr || child->kept_ != nullptr)
 		{
-			while ((*i)->locked_ == nullptr)
-			{
-				std::this_thread::yield();
-			}
-			children_.erase(i);
-			return;
+			++locked;
 		}
 	}
-	assert(true);
+	return locked;
 }
 
-template <typename Type> void owned_ptr<Type>::replace_(
-	reader_ptr<Type> *reader, reader_ptr<Type> *with)
+template <typename Type>
+	owned_detail::pin_table<Type, owned_detail::single_sync>
+	&single_thread_policy::owner<Type>::pins_()
 {
-	std::lock_guard<std::mutex> guard(mutex_);
-	(void)guard; // Remove 'unused' warnings.
+	return table_;
+}
 
-	auto i = children_.begin();
-	while (i != children_.end())
+template <typename Type> void single_thread_policy::owner<Type>::clear_()
+{
+	while (children_ != nullptr)
 	{
-		if (*i == reader)
-		{
-			*i = with;
-			return;
-		}
+		reader<Type> *child = children_;
+		child->parent_ = nullptr;
+		unlink_(child);
 	}
-	assert(true);
 }
 
-template <typename Type> reader_ptr<Type>::reader_ptr() : value_(nullptr),
-	locked_(nullptr), parent_(nullptr) {}
+template <typename Type> void single_thread_policy::owner<Type>::take_(
+	owner<Type> &other)
+{
+	for (auto child = other.children_; child != nullptr; child = child->next_)
+	{
+		child->parent_ = this;
+	}
+	value_ = other.value_;
+	children_ = other.children_;
+	size_ = other.size_;
+	table_.take(other.table_);
+	other.value_ = nullptr;
+	other.children_ = nullptr;
+	other.size_ = 0;
+}
 
-template <typename Type> reader_ptr<Type>::reader_ptr(owned_ptr<Type> *owner) :
-	reader_ptr<Type>()
+template <typename Type> void single_thread_policy::owner<Type>::link_(
+	reader<Type> *child)
 {
-	owner->get(*this);
+	child->prev_ = nullptr;
+	child->next_ = children_;
+	if (children_ != nullptr)
+	{
+		children_->prev_ = child;
+	}
+	children_ = child;
+	++size_;
 }
 
-template <typename Type> reader_ptr<Type>::reader_ptr(reader_ptr<Type> &other) :
-	reader_ptr<Type>()
+template <typename Type> void single_thread_policy::owner<Type>::unlink_(
+	reader<Type> *child)
 {
-	other.mutex_.lock();
-	if (other.parent_ != nullptr)
+	if (child->prev_ != nullptr)
+	{
+		child->prev_->next_ = child->next_;
+	}
+	else
+	{
+		children_ = child->next_;
+	}
+	if (child->next_ != nullptr)
 	{
-		other.parent_->get(*this);
+		child->next_->prev_ = child->prev_;
 	}
-	other.mutex_.unlock();
+	child->prev_ = nullptr;
+	child->next_ = nullptr;
+	--size_;
 }
 
-template <typename Type> reader_ptr<Type>::reader_ptr(reader_ptr<Type> &&other)
-	: reader_ptr<Type>()
+template <typename Type> single_thread_policy::reader<Type>::reader() :
+	locked_(nullptr), parent_(nullptr), prev_(nullptr), next_(nullptr),
+	kept_(nullptr) {}
+
+template <typename Type> single_thread_policy::reader<Type>::reader(
+	reader<Type> &other) : reader<Type>()
 {
-	other.mutex_.lock();
 	if (other.parent_ != nullptr)
 	{
-		other.parent_->replace_(other, this);
+		other.parent_->attach_(*this);
 	}
-	other.mutex_.unlock();
 }
 
-template <typename Type> reader_ptr<Type>::~reader_ptr()
+template <typename Type> single_thread_policy::reader<Type>::reader(
+	reader<Type> &&other) : reader<Type>()
 {
-	mutex_.lock();
+	assign_(other);
+}
+
+template <typename Type> single_thread_policy::reader<Type>::~reader()
+{
+	unlock_();
 	if (parent_ != nullptr)
 	{
-		parent_->remove_(this);
+		parent_->unlink_(this);
 	}
-	mutex_.unlock();
 }
 
-template <typename Type> Type *reader_ptr<Type>::lock()
+template <typename Type> Type *single_thread_policy::reader<Type>::lock_()
+{
+	unlock_();
+	locked_ = parent_ == nullptr ? nullptr : parent_->value_;
+	return locked_;
+}
+
+template <typename Type> void single_thread_policy::reader<Type>::stage_() {}
+
+template <typename Type> Type *single_thread_policy::reader<Type>::confirm_()
 {
-	return locked_ = value_;
+	return lock_();
 }
 
-template <typename Type> void reader_ptr<Type>::unlock()
+template <typename Type> void single_thread_policy::reader<Type>::unlock_()
 {
 	locked_ = nullptr;
+	if (kept_ != nullptr)
+	{
+		owned_detail::pin_table<Type, owned_detail::single_sync>::release(
+			kept_);
+		kept_ = nullptr;
+	}
 }
 
-template <typename Type> void reader_ptr<Type>::set_owner_(owned_ptr<Type> *owner)
+template <typename Type> owned_detail::pin<Type>
+	*single_thread_policy::reader<Type>::pin_()
 {
-	mutex_.lock();
-	if (owner != nullptr && parent_ != nullptr)
+	return parent_ == nullptr ? nullptr : parent_->table_.acquire();
+}
+
+template <typename Type> void single_thread_policy::reader<Type>::assign_(
+	reader<Type> &other)
+{
+	// Takes the other reader's place in the list, and its lock.
+	unlock_();
+	if (parent_ != nullptr)
 	{
-		parent_->remove_(this);
+		parent_->unlink_(this);
+		parent_ = nullptr;
 	}
-	parent_ = owner;
-	mutex_.unlock();
+	locked_ = other.locked_;
+	kept_ = other.kept_;
+	other.kept_ = nullptr;
+	if (other.parent_ != nullptr)
+	{
+		parent_ = other.parent_;
+		parent_->link_(this);
+		parent_->unlink_(&other);
+		other.parent_ = nullptr;
+	}
+	other.locked_ = nullptr;
 }
 
 #endif // OWNED_PTR__HPP_